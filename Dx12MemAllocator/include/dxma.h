@@ -29,31 +29,468 @@ SOFTWARE.
 
 #include <d3d12.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
-#include <unordered_set>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define DXMA_HAS_SSE2
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#if defined(DXMA_TIMING) || defined(DXMA_TRACE) || defined(DXMA_JOURNAL) || \
+    defined(DXMA_SHARED_STATS)
+#include <atomic>
+#endif
+
+#ifdef DXMA_TRACE
+#include <condition_variable>
+#include <cstdio>
+#include <thread>
+#endif
+
+#if (defined(DXMA_JOURNAL) || defined(DXMA_SHARED_STATS)) && !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef DXMA_PROFILING
+#include <cmath>
+#if !defined(_WIN32) && defined(__has_include)
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define DXMA_HAS_EXECINFO
+#endif
+#endif
+#endif
 
 #ifndef DXMA_HEAP_BLOCK_SIZE
-// Initial heap block size in bytes (default: 41.9424 MB)
+// Default heap block size in bytes, used when DxmaAllocatorDesc does not set
+// a preferred heap size (default: 41.9424 MB)
 #define DXMA_HEAP_BLOCK_SIZE 640 * UINT16_MAX
 #endif
 
+#ifndef DXMA_MIN_HEAP_SIZE
+// Size of the first heap of a type with DXMA_GROWTH_POLICY_GEOMETRIC, used
+// when DxmaAllocatorDesc does not set min_heap_size (default: 4 MB)
+#define DXMA_MIN_HEAP_SIZE 4 * 1024 * 1024
+#endif
+
 #ifndef DXMA_MAX_HEAP_COUNT
-// Maximum number of heaps (default: 200)
+// Default maximum number of heaps, used when DxmaAllocatorDesc does not set
+// max_heap_count (default: 200)
 #define DXMA_MAX_HEAP_COUNT 200
 #endif
 
+#ifndef DXMA_QUICK_LIST_MAX_SIZE
+// Largest range kept in quick lists, used when DxmaAllocatorDesc does not set
+// quick_list_max_size (default: 1 MB)
+#define DXMA_QUICK_LIST_MAX_SIZE 1024 * 1024
+#endif
+
+#ifndef DXMA_QUICK_LIST_FLUSH_INTERVAL
+// Number of ranges added to quick lists between two flushes of the ranges
+// that were not reused (default: 1024)
+#define DXMA_QUICK_LIST_FLUSH_INTERVAL 1024
+#endif
+
+#ifndef DXMA_IDLE_HOT_SIZE_COUNT
+// Number of missed quick list sizes per heap type and lifetime that dxmaIdle
+// pre-splits ranges for (default: 32)
+#define DXMA_IDLE_HOT_SIZE_COUNT 32
+#endif
+
+#ifndef DXMA_MAX_TAG_COUNT
+// Number of allocation tags with their own statistics (default: 16)
+#define DXMA_MAX_TAG_COUNT 16
+#endif
+
+#ifndef DXMA_FIT_POLICY
+// Policy choosing the free block of an allocation, FirstFit or BestFit
+// (default: FirstFit)
+#define DXMA_FIT_POLICY FirstFit
+#endif
+
+#ifndef DXMA_LOCK_POLICY
+// Policy guarding dxmaAllocate and dxmaFree, NoLock or MutexLock (default:
+// NoLock)
+#define DXMA_LOCK_POLICY NoLock
+#endif
+
+#ifndef DXMA_TRACKING_POLICY
+// Policy tracking live allocations in debug mode, DebugTracking or NoTracking
+// (default: DebugTracking)
+#define DXMA_TRACKING_POLICY DebugTracking
+#endif
+
+#ifndef DXMA_STATS_POLICY
+// Policy keeping tag, heap type and frame statistics, BasicStats or NoStats
+// (default: BasicStats)
+#define DXMA_STATS_POLICY BasicStats
+#endif
+
 #ifdef _DEBUG
 #define DXMA_DEBUG
 #endif
 
+#ifndef DXMA_DEBUG_MARGIN
+// Size of the corruption detection margins after allocations in bytes, only
+// used once dxmaEnableCorruptionDetection was called (default: 16)
+#define DXMA_DEBUG_MARGIN 16
+#endif
+
+// Define DXMA_TIMING to record per-phase latency histograms of dxmaAllocate
+// and dxmaFree (disabled by default)
+
+// Define DXMA_TRACE to enable the Chrome trace-event sink (disabled by default)
+
+// Define DXMA_PROFILING to enable the sampling allocation profiler, usable in
+// release builds (disabled by default)
+
+// Define DXMA_JOURNAL to enable the crash-safe allocation journal (disabled by
+// default)
+
+// Define DXMA_SHARED_STATS to enable publishing statistics to shared memory
+// for an external monitor (disabled by default)
+
+#ifdef DXMA_TRACE
+#ifndef DXMA_TRACE_FLUSH_INTERVAL_MS
+// Interval in which buffered trace events are written to the file
+#define DXMA_TRACE_FLUSH_INTERVAL_MS 100
+#endif
+#endif
+
+#ifdef DXMA_JOURNAL
+#ifndef DXMA_JOURNAL_SUMMARY_INTERVAL
+// Number of journal records between two summaries
+#define DXMA_JOURNAL_SUMMARY_INTERVAL 4096
+#endif
+#endif
+
+#ifdef DXMA_PROFILING
+#ifndef DXMA_PROFILING_MAX_FRAMES
+// Maximum number of frames captured per sampled call stack
+#define DXMA_PROFILING_MAX_FRAMES 24
+#endif
+#endif
+
+// Expected lifetime of an allocation, used to keep allocations that are freed
+// at different times apart
+enum DxmaLifetime {
+  DXMA_LIFETIME_PERMANENT = 0,  // Lives for most of the program, placed from
+                                // the bottom of heaps
+  DXMA_LIFETIME_LEVEL,          // Freed together with a level or scene,
+                                // placed in heaps of its own
+  DXMA_LIFETIME_TRANSIENT,      // Freed within a few frames, placed from the
+                                // top of heaps
+};
+
 // Information required for memory allocation
 struct DxmaAllocationInfo {
   UINT64 size = 0;                                 // Size of the allocation
   D3D12_HEAP_TYPE type = D3D12_HEAP_TYPE_DEFAULT;  // Type of heap
   UINT64 alignment = 0;                            // Alignment requirement
+  const char* name = nullptr;  // Optional name, copied by the allocator
+  UINT32 tag = 0;              // Category, less than DXMA_MAX_TAG_COUNT
+  bool name_resource = true;   // Pass the name to managed resources
+  DxmaLifetime lifetime = DXMA_LIFETIME_PERMANENT;  // Expected lifetime
+};
+
+// Memory usage of all allocations with the same tag
+struct DxmaTagStats {
+  UINT64 live_count = 0;  // Number of live allocations
+  UINT64 live_bytes = 0;  // Size of all live allocations
+  UINT64 peak_bytes = 0;  // Highest value of live_bytes
+  UINT64 peak_count = 0;  // Highest value of live_count
+};
+
+// Number of D3D12_HEAP_TYPE values that have their own statistics
+#define DXMA_HEAP_TYPE_COUNT 6
+
+// Current values and high-water marks of a heap type
+struct DxmaHeapTypeStats {
+  UINT64 heap_count = 0;             // Number of heaps
+  UINT64 heap_bytes = 0;             // Total size of the heaps
+  UINT64 allocation_count = 0;       // Number of live allocations
+  UINT64 allocation_bytes = 0;       // Size of the live allocations
+  UINT64 peak_heap_count = 0;        // Highest value of heap_count
+  UINT64 peak_heap_bytes = 0;        // Highest value of heap_bytes
+  UINT64 peak_allocation_count = 0;  // Highest value of allocation_count
+  UINT64 peak_allocation_bytes = 0;  // Highest value of allocation_bytes
+};
+
+// Allocator activity between dxmaBeginFrame and dxmaEndFrame
+struct DxmaFrameStats {
+  UINT64 frame_index = 0;         // Index passed to dxmaBeginFrame
+  UINT64 allocation_count = 0;    // Number of allocations
+  UINT64 free_count = 0;          // Number of frees
+  UINT64 allocated_bytes = 0;     // Size of the allocations
+  UINT64 freed_bytes = 0;         // Size of the freed allocations
+  UINT64 create_heap_count = 0;   // Number of CreateHeap calls
+  UINT64 created_heap_bytes = 0;  // Size of the created heaps
+  UINT64 release_heap_count = 0;  // Number of heaps released by dxmaTrim
+  UINT64 resize_count = 0;        // Number of dxmaResize calls that succeeded
+};
+
+// Size of new heaps as more heaps of a type are created
+enum DxmaGrowthPolicy {
+  DXMA_GROWTH_POLICY_FIXED = 0,  // Every heap has the preferred size
+  DXMA_GROWTH_POLICY_GEOMETRIC,  // Heaps start at min_heap_size and double
+                                 // the memory of their type, up to the
+                                 // preferred size
+};
+
+// Choice of the free block an allocation is placed in
+enum DxmaAllocationStrategy {
+  DXMA_ALLOCATION_STRATEGY_DEFAULT = 0,  // Use DXMA_FIT_POLICY
+  DXMA_ALLOCATION_STRATEGY_FIRST_FIT,    // First free block that fits
+  DXMA_ALLOCATION_STRATEGY_BEST_FIT,     // Smallest free block that fits
+};
+
+// Options of an allocator
+enum DxmaAllocatorFlags {
+  DXMA_ALLOCATOR_FLAG_NONE = 0,
+  DXMA_ALLOCATOR_FLAG_CORRUPTION_DETECTION = 1 << 0,  // Debug mode only
+};
+
+// Usage of a virtual block
+struct DxmaVirtualBlockStats {
+  UINT64 size = 0;                // Size of the block
+  UINT64 allocation_count = 0;    // Number of live allocations
+  UINT64 allocated_bytes = 0;     // Size of the live allocations
+  UINT64 free_block_count = 0;    // Number of free ranges
+  UINT64 free_bytes = 0;          // Size of the free ranges
+  UINT64 largest_free_block = 0;  // Size of the largest free range
+};
+
+// Range of a heap reserved from a block with dxmaBlockAllocate
+struct DxmaBlockAllocation {
+  ID3D12Heap* heap = nullptr;  // Heap of the block
+  UINT64 offset = 0;           // Offset within the heap
+  UINT64 size = 0;             // Size of the range
+};
+
+// Function called when the allocator creates or releases a heap
+typedef void (*PFN_dxmaHeapCallback)(ID3D12Heap* heap, D3D12_HEAP_TYPE type,
+                                     UINT64 size, UINT32 heap_index,
+                                     void* user_data);
+
+// Runtime configuration of an allocator
+struct DxmaAllocatorDesc {
+  ID3D12Device* device = nullptr;  // Device heaps are created on
+  UINT64 preferred_heap_size[DXMA_HEAP_TYPE_COUNT]{};  // Per heap type, 0 uses
+                                                       // DXMA_HEAP_BLOCK_SIZE
+  UINT64 page_size[DXMA_HEAP_TYPE_COUNT]{};  // Per heap type, 0 tracks free
+                                             // blocks in lists, otherwise a
+                                             // power of two that heaps are
+                                             // split into (e.g. 64 KB)
+  DxmaGrowthPolicy growth_policy = DXMA_GROWTH_POLICY_FIXED;  // Heap sizing
+  UINT64 min_heap_size = 0;   // Size of the first heap of a type with
+                              // geometric growth, 0 uses DXMA_MIN_HEAP_SIZE
+  UINT32 max_heap_count = 0;  // Maximum number of heaps, 0 uses
+                              // DXMA_MAX_HEAP_COUNT
+  DxmaAllocationStrategy strategy = DXMA_ALLOCATION_STRATEGY_DEFAULT;
+  UINT32 flags = DXMA_ALLOCATOR_FLAG_NONE;         // DxmaAllocatorFlags
+  D3D12_HEAP_FLAGS heap_flags = D3D12_HEAP_FLAG_NONE;  // Flags of new heaps
+  UINT32 quick_list_depth = 0;  // Freed ranges kept per size for reuse
+                                // without coalescing, 0 disables quick lists
+  UINT64 quick_list_max_size = 0;  // Largest range kept in quick lists, 0
+                                   // uses DXMA_QUICK_LIST_MAX_SIZE
+  UINT32 pending_free_limit = 0;  // Freed ranges collected per heap before
+                                  // they are merged in one sorted sweep, 0
+                                  // merges on every free
+  PFN_dxmaHeapCallback on_create_heap = nullptr;   // Called after CreateHeap
+  PFN_dxmaHeapCallback on_release_heap = nullptr;  // Called before Release
+  void* callback_user_data = nullptr;  // Passed to the heap callbacks
+};
+
+#ifdef DXMA_TIMING
+// Number of log2 buckets in a timing histogram
+#define DXMA_TIMING_BUCKET_COUNT 32
+
+// Phases of dxmaAllocate and dxmaFree measured when DXMA_TIMING is defined
+enum DxmaTimingPhase {
+  DXMA_TIMING_PHASE_ALLOCATE_SEARCH = 0,  // Searching the free block list
+  DXMA_TIMING_PHASE_ALLOCATE_SPLIT,       // Splitting or removing a free block
+  DXMA_TIMING_PHASE_CREATE_HEAP,          // Creating a new heap
+  DXMA_TIMING_PHASE_ALLOCATE_METADATA,    // Creating the allocation object
+  DXMA_TIMING_PHASE_FREE_SEARCH,          // Searching the insert position
+  DXMA_TIMING_PHASE_FREE_MERGE,           // Merging adjacent free blocks
+  DXMA_TIMING_PHASE_COUNT
+};
+
+// Latency histogram of a single phase, bucket i counts samples that took
+// [2^i, 2^(i+1)) nanoseconds (bucket 0 also counts samples of 0 ns)
+struct DxmaTimingHistogram {
+  UINT64 count = 0;     // Number of samples
+  UINT64 total_ns = 0;  // Sum of all samples in nanoseconds
+  UINT64 max_ns = 0;    // Slowest sample in nanoseconds
+  UINT64 buckets[DXMA_TIMING_BUCKET_COUNT]{};  // Samples per log2 bucket
+};
+#endif
+
+#ifdef DXMA_DEBUG
+// Memory usage of the allocations made at one dxmaAllocate call site
+struct DxmaCallSiteStats {
+  const char* file = nullptr;  // File of the call site
+  int line = 0;                // Line of the call site
+  UINT64 live_count = 0;       // Number of live allocations
+  UINT64 live_bytes = 0;       // Size of all live allocations
+  UINT64 peak_bytes = 0;       // Highest value of live_bytes
+  UINT64 total_count = 0;      // Number of allocations ever made
+};
+
+// Live allocation recorded by dxmaTakeSnapshot
+struct DxmaSnapshotEntry {
+  UINT64 id = 0;               // Allocation id, increasing in allocation order
+  UINT64 size = 0;             // Size of the allocation
+  UINT32 heap_index = 0;       // Index of the heap
+  UINT32 tag = 0;              // Tag of the allocation
+  const char* file = nullptr;  // File of the call site
+  int line = 0;                // Line of the call site
+};
+
+// Flat array of the live allocations at one point in time, sorted by id
+struct DxmaSnapshot {
+  UINT64 next_id = 0;      // Id of the first allocation made afterwards
+  UINT64 entry_count = 0;  // Number of live allocations
+  DxmaSnapshotEntry* entries = nullptr;  // Live allocations
+};
+
+// Allocations made between two snapshots that are alive in the later one
+struct DxmaSnapshotDiff {
+  const DxmaSnapshotEntry* entries = nullptr;  // Entries of the later snapshot
+  UINT64 entry_count = 0;                      // Number of entries
+  UINT64 total_bytes = 0;                      // Size of all entries
+};
+#endif
+
+#ifdef DXMA_PROFILING
+// Captures the return addresses of the calling thread into frames and returns
+// the number of frames written
+typedef UINT32 (*PFN_dxmaCaptureStack)(void** frames, UINT32 max_frames,
+                                       void* user_data);
+
+// Live memory attributed to a sampled call stack
+struct DxmaStackReport {
+  UINT64 live_bytes = 0;        // Estimated live bytes allocated from the stack
+  UINT64 live_allocations = 0;  // Number of live sampled allocations
+  UINT32 frame_count = 0;       // Number of captured frames
+  void* frames[DXMA_PROFILING_MAX_FRAMES]{};  // Return addresses
+};
+#endif
+
+#ifdef DXMA_JOURNAL
+// Identifies a journal file ("DXMJ")
+#define DXMA_JOURNAL_MAGIC 0x4A4D5844u
+
+// Version of the journal file layout
+#define DXMA_JOURNAL_VERSION 2u
+
+// Event stored in a journal record
+enum DxmaJournalEvent : UINT16 {
+  DXMA_JOURNAL_EVENT_NONE = 0,     // Record was never written
+  DXMA_JOURNAL_EVENT_ALLOCATE,     // Allocation was made
+  DXMA_JOURNAL_EVENT_FREE,         // Allocation was freed
+  DXMA_JOURNAL_EVENT_CREATE_HEAP,  // Heap was created
+  DXMA_JOURNAL_EVENT_RELEASE_HEAP,  // Heap was released by dxmaTrim
+  DXMA_JOURNAL_EVENT_RESIZE,        // Allocation was resized to size
 };
 
+// Record of the journal ring, complete once sequence is not 0, the record of
+// sequence n is stored at index (n - 1) % record_count
+struct DxmaJournalRecord {
+  std::atomic<UINT64> sequence;  // Sequence number, written last
+  UINT64 time_ns;                // Time of the event in nanoseconds
+  UINT64 offset;                 // Offset within the heap
+  UINT64 size;                   // Size of the allocation or heap
+  UINT32 heap_index;             // Index of the heap
+  UINT16 heap_type;              // D3D12_HEAP_TYPE of the heap
+  UINT16 event;                  // DxmaJournalEvent
+};
+
+// Heap known to the journal
+struct DxmaJournalHeap {
+  UINT64 size;  // Size of the heap
+  UINT32 type;  // D3D12_HEAP_TYPE of the heap
+  UINT32 used;  // Whether the heap exists
+};
+
+// Header at the start of a journal file, followed by the heap table of
+// heap_capacity entries and the record ring
+struct DxmaJournalHeader {
+  UINT32 magic;                          // DXMA_JOURNAL_MAGIC
+  UINT32 version;                        // DXMA_JOURNAL_VERSION
+  UINT64 record_count;                   // Number of records in the ring
+  std::atomic<UINT64> next_sequence;     // Sequence of the newest record
+  std::atomic<UINT64> summary_sequence;  // Odd while the summary is written
+  UINT64 summary_time_ns;                // Time of the last summary
+  UINT64 summary_record;     // Sequence of the newest summarized record
+  UINT64 live_allocations;   // Number of live allocations at the summary
+  UINT64 live_bytes[DXMA_HEAP_TYPE_COUNT];  // Live bytes per heap type
+  UINT32 heap_count;     // Number of heap slots used
+  UINT32 heap_capacity;  // Number of heap slots, the allocator's heap limit
+};
+#endif
+
+#ifdef DXMA_SHARED_STATS
+// Identifies a shared statistics region ("DXMS")
+#define DXMA_SHARED_STATS_MAGIC 0x534D5844u
+
+// Version of the shared statistics layout
+#define DXMA_SHARED_STATS_VERSION 1u
+
+// Statistics of one heap type
+struct DxmaSharedTypeStats {
+  UINT64 heap_count;          // Number of heaps
+  UINT64 heap_bytes;          // Total size of the heaps
+  UINT64 allocation_count;    // Number of live allocations
+  UINT64 allocation_bytes;    // Size of the live allocations
+  UINT64 free_block_count;    // Number of free blocks, as of the last publish
+  UINT64 free_bytes;          // Size of the free blocks, as of the last publish
+  UINT64 largest_free_block;  // Largest free block, as of the last publish
+  double fragmentation;       // 1 - largest_free_block / free_bytes
+};
+
+// Statistics published by the allocator
+struct DxmaSharedStats {
+  UINT64 update_count;  // Number of updates since the region was opened
+  UINT64 time_ns;       // Time of the last update in nanoseconds
+  UINT64 budget_bytes;  // Budget passed to the last dxmaPublishStats call
+  UINT64 heap_count;    // Number of heaps of all types
+  UINT64 allocation_count;  // Number of live allocations of all types
+  DxmaSharedTypeStats types[DXMA_HEAP_TYPE_COUNT];  // Indexed by heap type
+};
+
+// Shared memory region, stats may only be read while sequence is even and
+// unchanged across the read
+struct DxmaSharedStatsRegion {
+  UINT32 magic;                   // DXMA_SHARED_STATS_MAGIC
+  UINT32 version;                 // DXMA_SHARED_STATS_VERSION
+  std::atomic<UINT64> sequence;   // Odd while the stats are written
+  DxmaSharedStats stats;          // Published statistics
+};
+#endif
+
 namespace dxma_detail {
 
 // Represents a memory allocation within a heap
@@ -68,10 +505,30 @@ struct Allocation {
   bool manage_resource_ =
       true;  // Whether the resource is managed by this allocation
   bool memory_mapped_ = false;  // Whether the resource is memory-mapped
+  bool name_resource_ = true;   // Whether to pass the name to the resource
+  UINT32 tag_ = 0;              // Category of the allocation
+  const char* name_ = nullptr;  // Interned name of the allocation
+  DxmaLifetime lifetime_ = DXMA_LIFETIME_PERMANENT;  // Lifetime hint
+  UINT64 alignment_ = 0;        // Alignment the size is rounded up to
 
 #ifdef DXMA_DEBUG
   const char* file_ = nullptr;  // File where the allocation was made
   int line_ = 0;                // Line where the allocation was made
+  Allocation* prev_ = nullptr;  // Previous tracked allocation
+  Allocation* next_ = nullptr;  // Next tracked allocation
+  bool tracked_ = false;        // Whether the allocation is tracked
+  UINT64 id_ = 0;               // Id in allocation order
+  DxmaCallSiteStats* site_ = nullptr;  // Statistics of the call site
+  UINT64 margin_ = 0;  // Size of the corruption detection margin before it
+#endif
+
+#ifdef DXMA_PROFILING
+  UINT32 sample_stack_ = 0;   // Id of the sampled call stack (0 = not sampled)
+  UINT64 sample_bytes_ = 0;   // Bytes represented by the sample
+#endif
+
+#ifdef DXMA_JOURNAL
+  UINT32 journal_id_ = 0;  // Id of the journal that recorded it (0 = none)
 #endif
 
  public:
@@ -110,10 +567,48 @@ struct Allocation {
   ID3D12Heap* GetHeap() const { return heap_; }
   ID3D12Resource* GetResource() const { return resource_; }
   bool IsMemoryMapped() const { return memory_mapped_; }
+  bool ShouldNameResource() const { return name_resource_; }
+  UINT32 GetTag() const { return tag_; }
+  const char* GetName() const { return name_; }
+  DxmaLifetime GetLifetime() const { return lifetime_; }
+  UINT64 GetAlignment() const { return alignment_; }
+
+  // Offset of the reserved range, including corruption detection margins
+  UINT64 GetBlockOffset() const {
+#ifdef DXMA_DEBUG
+    return offset_ - margin_;
+#else
+    return offset_;
+#endif
+  }
+
+  // Size of the reserved range, including corruption detection margins
+  UINT64 GetBlockSize() const {
+#ifdef DXMA_DEBUG
+    return margin_ == 0 ? size_ : margin_ + size_ + DXMA_DEBUG_MARGIN;
+#else
+    return size_;
+#endif
+  }
 
 #ifdef DXMA_DEBUG
   const char* GetFile() const { return file_; }
   int GetLine() const { return line_; }
+  Allocation* GetPrev() const { return prev_; }
+  Allocation* GetNext() const { return next_; }
+  bool IsTracked() const { return tracked_; }
+  UINT64 GetId() const { return id_; }
+  UINT64 GetMargin() const { return margin_; }
+  DxmaCallSiteStats* GetCallSite() const { return site_; }
+#endif
+
+#ifdef DXMA_PROFILING
+  UINT32 GetSampleStack() const { return sample_stack_; }
+  UINT64 GetSampleBytes() const { return sample_bytes_; }
+#endif
+
+#ifdef DXMA_JOURNAL
+  UINT32 GetJournalId() const { return journal_id_; }
 #endif
 
   // Setters
@@ -124,6 +619,39 @@ struct Allocation {
 
   void SetMemoryMapped(bool mapped) { memory_mapped_ = mapped; }
 
+  void SetName(const char* name, bool name_resource) {
+    name_ = name;
+    name_resource_ = name_resource;
+  }
+
+  void SetTag(UINT32 tag) { tag_ = tag; }
+
+  void SetLifetime(DxmaLifetime lifetime) { lifetime_ = lifetime; }
+
+  void SetAlignment(UINT64 alignment) { alignment_ = alignment; }
+
+  void SetSize(UINT64 size) { size_ = size; }
+
+#ifdef DXMA_DEBUG
+  void SetPrev(Allocation* prev) { prev_ = prev; }
+  void SetNext(Allocation* next) { next_ = next; }
+  void SetTracked(bool tracked) { tracked_ = tracked; }
+  void SetId(UINT64 id) { id_ = id; }
+  void SetMargin(UINT64 margin) { margin_ = margin; }
+  void SetCallSite(DxmaCallSiteStats* site) { site_ = site; }
+#endif
+
+#ifdef DXMA_PROFILING
+  void SetSample(UINT32 stack, UINT64 bytes) {
+    sample_stack_ = stack;
+    sample_bytes_ = bytes;
+  }
+#endif
+
+#ifdef DXMA_JOURNAL
+  void SetJournalId(UINT32 journal_id) { journal_id_ = journal_id; }
+#endif
+
   bool operator==(const Allocation& other) const {
     return size_ == other.size_ && offset_ == other.offset_ &&
            heap_index_ == other.heap_index_;
@@ -138,7 +666,9 @@ struct FreeBlock {
   D3D12_HEAP_TYPE heap_type_ = D3D12_HEAP_TYPE_DEFAULT;  // Type of heap
   UINT32 heap_index_ = 0;                                // Index of the heap
   FreeBlock* next_ = nullptr;   // Pointer to the next free block
+  FreeBlock* prev_ = nullptr;   // Pointer to the previous free block
   ID3D12Heap* heap_ = nullptr;  // Pointer to the heap
+  UINT32 slot_ = 0;             // Index in the flat arrays of its list
 
  public:
   FreeBlock(UINT64 size, UINT64 offset, D3D12_HEAP_TYPE type, UINT32 heap_index,
@@ -156,251 +686,3417 @@ struct FreeBlock {
   D3D12_HEAP_TYPE GetHeapType() const { return heap_type_; }
   UINT32 GetHeapIndex() const { return heap_index_; }
   FreeBlock* GetNext() const { return next_; }
+  FreeBlock* GetPrev() const { return prev_; }
   ID3D12Heap* GetHeap() const { return heap_; }
+  UINT32 GetSlot() const { return slot_; }
 
   // Setters
   void SetSize(UINT64 size) { size_ = size; }
   void SetOffset(UINT64 offset) { offset_ = offset; }
   void SetNext(FreeBlock* next) { next_ = next; }
+  void SetPrev(FreeBlock* prev) { prev_ = prev; }
+  void SetSlot(UINT32 slot) { slot_ = slot; }
 };
 
-// Hash function for allocations (used in debug mode)
-struct AllocationHasher {
-  size_t operator()(Allocation* a) const {
-    size_t ho = std::hash<UINT64>{}(a->GetOffset());
-    size_t hi = std::hash<UINT32>{}(a->GetHeapIndex());
-    return ho ^ (hi << 1);
-  }
-};
+// Round an offset up to a power of two alignment, 0 means no alignment
+inline UINT64 AlignUp(UINT64 offset, UINT64 alignment) {
+  return alignment == 0 ? offset : (offset + alignment - 1) & ~(alignment - 1);
+}
 
-// Main allocator class for managing memory allocations
-class Allocator {
- private:
-  FreeBlock* head_ = nullptr;       // Head of the free block list
-  ID3D12Device* device_ = nullptr;  // Pointer to the DirectX 12 device
-  UINT32 heap_count_ = 0;           // Number of allocated heaps
-  ID3D12Heap* heaps_[DXMA_MAX_HEAP_COUNT]{};  // Array of heaps
+// Whether an aligned range of size bytes fits into a free block
+inline bool Fits(const FreeBlock* block, UINT64 size, UINT64 alignment) {
+  UINT64 padding = AlignUp(block->GetOffset(), alignment) - block->GetOffset();
+  return block->GetSize() >= size && block->GetSize() - size >= padding;
+}
 
-#ifdef DXMA_DEBUG
-  std::unordered_set<Allocation*, AllocationHasher>
-      allocations_;  // Track allocations in debug mode
+// Freed range waiting to be merged into a free list
+struct PendingRange {
+  UINT64 offset = 0;  // Offset of the range within the heap
+  UINT64 size = 0;    // Size of the range
+};
+
+// Smallest value of at least min_size in a flat array of sizes below 2^63,
+// comparing 8 sizes per iteration with AVX2 or NEON where available.
+// Returns 0 if no size is large enough, min_size must not be 0
+inline UINT64 FindSmallestSize(const UINT64* sizes, size_t count,
+                               UINT64 min_size) {
+  UINT64 best = UINT64_MAX;
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i limit =
+      _mm256_set1_epi64x(static_cast<long long>(min_size - 1));
+  __m256i lanes[2] = {_mm256_set1_epi64x(INT64_MAX),
+                      _mm256_set1_epi64x(INT64_MAX)};
+  for (; i + 8 <= count; i += 8) {
+    for (int half = 0; half < 2; half++) {
+      __m256i value = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(sizes + i + half * 4));
+      __m256i take = _mm256_and_si256(_mm256_cmpgt_epi64(value, limit),
+                                      _mm256_cmpgt_epi64(lanes[half], value));
+      lanes[half] = _mm256_blendv_epi8(lanes[half], value, take);
+    }
+  }
+  alignas(32) UINT64 values[8];
+  _mm256_store_si256(reinterpret_cast<__m256i*>(values), lanes[0]);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(values + 4), lanes[1]);
+  for (UINT64 value : values) {
+    if (value != static_cast<UINT64>(INT64_MAX)) best = std::min(best, value);
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint64x2_t limit = vdupq_n_u64(min_size - 1);
+  uint64x2_t lanes[4];
+  for (uint64x2_t& lane : lanes) lane = vdupq_n_u64(UINT64_MAX);
+  for (; i + 8 <= count; i += 8) {
+    for (int quarter = 0; quarter < 4; quarter++) {
+      uint64x2_t value = vld1q_u64(sizes + i + quarter * 2);
+      uint64x2_t take = vandq_u64(vcgtq_u64(value, limit),
+                                  vcgtq_u64(lanes[quarter], value));
+      lanes[quarter] = vbslq_u64(take, value, lanes[quarter]);
+    }
+  }
+  for (const uint64x2_t& lane : lanes) {
+    best = std::min({best, vgetq_lane_u64(lane, 0), vgetq_lane_u64(lane, 1)});
+  }
 #endif
+  for (; i < count; i++) {
+    if (sizes[i] >= min_size && sizes[i] < best) best = sizes[i];
+  }
+  return best == UINT64_MAX ? 0 : best;
+}
 
- public:
-  Allocator() = default;
-  explicit Allocator(ID3D12Device* device) : device_(device) {}
+// Free ranges of one heap or virtual block in a doubly linked list sorted by
+// offset, adjacent ranges are always merged. The sizes are mirrored in a flat
+// array for vectorized searches
+class FreeList {
+ private:
+  FreeBlock* head_ = nullptr;  // Free block with the lowest offset
+  UINT64 free_bytes_ = 0;      // Size of all free blocks
+  std::vector<UINT64> block_sizes_;  // Size of each block in blocks_
+  std::vector<FreeBlock*> blocks_;   // Free blocks in no particular order
+  mutable UINT64 largest_ = 0;       // Size of the largest free block
+  mutable bool largest_stale_ = false;  // Whether largest_ must be rescanned
 
-  ~Allocator() {
-    // Release all allocated heaps
-    for (UINT32 i = 0; i < heap_count_; i++) {
-      heaps_[i]->Release();
-    }
-    heap_count_ = 0;
+ public:
+  FreeList() = default;
+  ~FreeList() { Clear(); }
 
-    PrintLeakedMemory();
+  FreeList(FreeList&& other) noexcept { *this = std::move(other); }
 
-    // Free all free blocks
-    FreeBlock* ptr = head_;
-    while (ptr) {
-      FreeBlock* next = ptr->GetNext();
-      delete ptr;
-      ptr = next;
-    }
+  FreeList& operator=(FreeList&& other) noexcept {
+    std::swap(head_, other.head_);
+    std::swap(free_bytes_, other.free_bytes_);
+    std::swap(block_sizes_, other.block_sizes_);
+    std::swap(blocks_, other.blocks_);
+    std::swap(largest_, other.largest_);
+    std::swap(largest_stale_, other.largest_stale_);
+    return *this;
   }
 
-  // Print memory leaks in debug mode
-  void PrintLeakedMemory() {
-#ifdef DXMA_DEBUG
-    for (Allocation* alloc : allocations_) {
-      std::cerr << "[DXMA] Memory Leaked: " << alloc->GetSize()
-                << " bytes allocated at " << alloc->GetFile() << ":"
-                << alloc->GetLine() << "\n";
-    }
-#endif
+  FreeList(const FreeList&) = delete;
+  FreeList& operator=(const FreeList&) = delete;
+
+  // Make the whole range of a heap free
+  void Reset(UINT64 size, D3D12_HEAP_TYPE type, UINT32 heap_index,
+             ID3D12Heap* heap, UINT64 offset = 0) {
+    Clear();
+    Link(new FreeBlock(size, offset, type, heap_index, nullptr, heap),
+         nullptr);
+    free_bytes_ = size;
   }
 
-  // Get the number of free blocks
-  uint32_t GetFreeBlockCount() const {
-    uint32_t count = 0;
-    FreeBlock* ptr = head_;
-    while (ptr) {
-      ptr = ptr->GetNext();
-      count++;
+  // Delete all free blocks
+  void Clear() {
+    while (head_) {
+      FreeBlock* next = head_->GetNext();
+      delete head_;
+      head_ = next;
     }
-    return count;
+    free_bytes_ = 0;
+    block_sizes_.clear();
+    blocks_.clear();
+    largest_ = 0;
+    largest_stale_ = false;
   }
 
-  // Get the head of the free block list
+  // Getters
   FreeBlock* GetHead() const { return head_; }
+  UINT32 GetBlockCount() const { return static_cast<UINT32>(blocks_.size()); }
+  UINT64 GetFreeBytes() const { return free_bytes_; }
 
-  // Set the head of the free block list
-  void SetHead(FreeBlock* new_head) { head_ = new_head; }
+  // Get the size of the largest free block, only rescanned after the largest
+  // block shrank or was removed
+  UINT64 GetLargestFreeBlock() const {
+    if (largest_stale_) {
+      largest_ = 0;
+      for (UINT64 size : block_sizes_) largest_ = std::max(largest_, size);
+      largest_stale_ = false;
+    }
+    return largest_;
+  }
 
-  // Get the DirectX 12 device
-  ID3D12Device* GetDevice() const { return device_; }
+  // Find the smallest free block with room for an aligned range of size
+  // bytes, the one with the lowest offset if several have the same size
+  FreeBlock* FindSmallest(UINT64 size, UINT64 alignment) const {
+    UINT64 smallest =
+        FindSmallestSize(block_sizes_.data(), block_sizes_.size(), size);
+    if (smallest == 0) return nullptr;
 
-  // Get the array of allocated heaps
-  ID3D12Heap** GetHeaps() { return heaps_; }
+    FreeBlock* best = nullptr;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      if (block_sizes_[i] == smallest &&
+          (!best || blocks_[i]->GetOffset() < best->GetOffset())) {
+        best = blocks_[i];
+      }
+    }
+    if (Fits(best, size, alignment)) return best;
 
-  // Get the number of allocated heaps
-  UINT32 GetHeapCount() const { return heap_count_; }
+    // The alignment padding does not fit, compare every large enough block
+    best = nullptr;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      FreeBlock* block = blocks_[i];
+      if (block_sizes_[i] < size || !Fits(block, size, alignment)) continue;
+      if (!best || block->GetSize() < best->GetSize() ||
+          (block->GetSize() == best->GetSize() &&
+           block->GetOffset() < best->GetOffset())) {
+        best = block;
+      }
+    }
+    return best;
+  }
 
-  // Increment the heap count
-  void IncrementHeapCount() { heap_count_++; }
+  // Reserve an aligned range of size bytes in a block returned by a fit
+  // policy, returns the offset of the range. The range is taken from the end
+  // of the block if top_down is set
+  UINT64 Split(FreeBlock* block, UINT64 size, UINT64 alignment,
+               bool top_down = false) {
+    UINT64 offset = AlignUp(block->GetOffset(), alignment);
+    if (top_down) {
+      offset = block->GetOffset() + block->GetSize() - size;
+      if (alignment != 0) offset &= ~(alignment - 1);
+    }
+    UINT64 front = offset - block->GetOffset();
+    UINT64 back = block->GetSize() - front - size;
+    free_bytes_ -= size;
 
-  // Add an allocation to the tracking set (debug mode only)
-  void AddAllocation(Allocation* allocation) {
-#ifdef DXMA_DEBUG
-    allocations_.insert(allocation);
-#endif
+    if (front == 0 && back == 0) {
+      // Exact match: remove the free block
+      Unlink(block);
+    } else if (front == 0) {
+      block->SetOffset(offset + size);
+      Resize(block, back);
+    } else {
+      // Keep the alignment padding as a free block
+      Resize(block, front);
+      if (back > 0) {
+        Link(new FreeBlock(back, offset + size, block->GetHeapType(),
+                           block->GetHeapIndex(), nullptr, block->GetHeap()),
+             block);
+      }
+    }
+    return offset;
   }
 
-  // Remove an allocation from the tracking set (debug mode only)
-  uint32_t RemoveAllocation(Allocation* allocation) {
-#ifdef DXMA_DEBUG
-    return allocations_.erase(allocation);
-#else
-    return 0;
-#endif
+  // Reserve the front of the free block that starts at offset, returns false
+  // if no free block starts there or it is smaller than size
+  bool AllocateAt(UINT64 offset, UINT64 size) {
+    FreeBlock* prev = FindPrevious(offset);
+    FreeBlock* block = prev ? prev->GetNext() : head_;
+    if (!block || block->GetOffset() != offset || block->GetSize() < size) {
+      return false;
+    }
+    Split(block, size, 0);
+    return true;
   }
 
-  // Get all active allocations (debug mode only)
-  std::unordered_set<Allocation*, AllocationHasher> GetAllocations() {
-#ifdef DXMA_DEBUG
-    return allocations_;
-#else
-    return std::unordered_set<Allocation*, AllocationHasher>();
-#endif
+  // Find the free block before a range that is returned
+  FreeBlock* FindPrevious(UINT64 offset) const {
+    FreeBlock* prev = nullptr;
+    for (FreeBlock* ptr = head_; ptr && ptr->GetOffset() < offset;
+         ptr = ptr->GetNext()) {
+      prev = ptr;
+    }
+    return prev;
   }
-};
-
-// Define handle types for the library user
-#define DEFINE_DXMA_HANDLE(name) typedef dxma_detail::name* Dxma##name;
 
-void dxmaAllocateImpl(Allocator* allocator,
-                      const DxmaAllocationInfo& alloc_info,
-                      Allocation** allocation
-#ifdef DXMA_DEBUG
-                      ,
-                      const char* file, int line
-#endif
-) {
-  UINT64 size = alloc_info.size;
-  D3D12_HEAP_TYPE type = alloc_info.type;
-  UINT64 alignment = alloc_info.alignment;
-
-  if (size == 0) return;
-  size = alignment == 0 ? size : (size + alignment - 1) & ~(alignment - 1);
-
-  FreeBlock* ptr = allocator->GetHead();
-  FreeBlock* prev = nullptr;
-
-  while (ptr) {
-    UINT64 ptr_size = ptr->GetSize();
-    if (ptr->GetHeapType() != type) ptr_size = 0;
-
-    if (ptr_size >= size) {
-      UINT64 ptr_offset = ptr->GetOffset();
-      ID3D12Heap* ptr_heap = ptr->GetHeap();
-      UINT32 ptr_heap_index = ptr->GetHeapIndex();
-
-      if (ptr_size == size) {
-        // Exact match: remove the free block
-        if (prev) {
-          prev->SetNext(ptr->GetNext());
-        } else {
-          allocator->SetHead(ptr->GetNext());
-        }
-        delete ptr;
+  // Return a batch of ranges in one sweep over the list, merging each with its
+  // neighbours
+  void InsertBatch(std::vector<PendingRange>& ranges, D3D12_HEAP_TYPE type,
+                   UINT32 heap_index, ID3D12Heap* heap) {
+    std::sort(ranges.begin(), ranges.end(),
+              [](const PendingRange& a, const PendingRange& b) {
+                return a.offset < b.offset;
+              });
 
-        *allocation =
-            new Allocation(size, ptr_offset, type, ptr_heap_index, ptr_heap
-#ifdef DXMA_DEBUG
-                           ,
-                           file, line
-#endif
-            );
-#ifdef DXMA_DEBUG
-        allocator->AddAllocation(*allocation);
-#endif
-        return;
+    // Ranges are sorted, so the previous block only moves forward
+    FreeBlock* prev = nullptr;
+    for (const PendingRange& range : ranges) {
+      FreeBlock* next = prev ? prev->GetNext() : head_;
+      while (next && next->GetOffset() < range.offset) {
+        prev = next;
+        next = next->GetNext();
       }
+      Insert(prev, range.offset, range.size, type, heap_index, heap);
+    }
+  }
 
-      // Split the free block
-      ptr->SetSize(ptr_size - size);
-      ptr->SetOffset(ptr_offset + size);
+  // Return a range after the block found by FindPrevious, merging it with
+  // its neighbours
+  void Insert(FreeBlock* prev, UINT64 offset, UINT64 size,
+              D3D12_HEAP_TYPE type, UINT32 heap_index, ID3D12Heap* heap) {
+    free_bytes_ += size;
+    FreeBlock* next = prev ? prev->GetNext() : head_;
 
-      *allocation =
-          new Allocation(size, ptr_offset, type, ptr_heap_index, ptr_heap
-#ifdef DXMA_DEBUG
-                         ,
-                         file, line
-#endif
-          );
-#ifdef DXMA_DEBUG
-      allocator->AddAllocation(*allocation);
-#endif
-      return;
+    // Merge with the previous block if possible
+    FreeBlock* block = prev;
+    if (prev && prev->GetOffset() + prev->GetSize() == offset) {
+      Resize(prev, prev->GetSize() + size);
+    } else {
+      // Insert the new block
+      block = new FreeBlock(size, offset, type, heap_index, nullptr, heap);
+      Link(block, prev);
     }
 
-    prev = ptr;
-    ptr = ptr->GetNext();
+    // Merge with the next block if possible
+    if (next && block->GetOffset() + block->GetSize() == next->GetOffset()) {
+      UINT64 next_size = next->GetSize();
+      Unlink(next);
+      Resize(block, block->GetSize() + next_size);
+    }
   }
 
-  // Out of memory: allocate a new heap
-  UINT64 heap_block_size = DXMA_HEAP_BLOCK_SIZE;
-  if (heap_block_size - size <= 0) heap_block_size = size * 4;
+ private:
+  // Insert a new block after prev, or at the front if prev is null
+  void Link(FreeBlock* block, FreeBlock* prev) {
+    FreeBlock* next = prev ? prev->GetNext() : head_;
+    block->SetPrev(prev);
+    block->SetNext(next);
+    if (next) next->SetPrev(block);
+    if (prev) {
+      prev->SetNext(block);
+    } else {
+      head_ = block;
+    }
 
-  ID3D12Device* device = allocator->GetDevice();
-  assert(device);
+    block->SetSlot(static_cast<UINT32>(blocks_.size()));
+    blocks_.push_back(block);
+    block_sizes_.push_back(block->GetSize());
+    largest_ = std::max(largest_, block->GetSize());
+  }
 
-  D3D12_HEAP_DESC heap_desc{};
-  heap_desc.SizeInBytes = heap_block_size;
-  heap_desc.Flags = D3D12_HEAP_FLAG_NONE;
-  heap_desc.Properties.Type = type;
-  heap_desc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+  // Remove and delete a block
+  void Unlink(FreeBlock* block) {
+    if (block->GetPrev()) {
+      block->GetPrev()->SetNext(block->GetNext());
+    } else {
+      head_ = block->GetNext();
+    }
+    if (block->GetNext()) block->GetNext()->SetPrev(block->GetPrev());
 
-  ID3D12Heap* new_heap = nullptr;
-  HRESULT hr = device->CreateHeap(&heap_desc, IID_PPV_ARGS(&new_heap));
-  assert(SUCCEEDED(hr));
+    // Move the last block into the slot of the removed one
+    UINT32 slot = block->GetSlot();
+    blocks_[slot] = blocks_.back();
+    block_sizes_[slot] = block_sizes_.back();
+    blocks_[slot]->SetSlot(slot);
+    blocks_.pop_back();
+    block_sizes_.pop_back();
 
-  if (FAILED(hr)) return;
+    if (block->GetSize() == largest_) largest_stale_ = true;
+    delete block;
+  }
 
-  UINT32 heap_count = allocator->GetHeapCount();
-  ID3D12Heap** heaps = allocator->GetHeaps();
-  heaps[heap_count] = new_heap;
+  // Change the size of a block
+  void Resize(FreeBlock* block, UINT64 size) {
+    if (size < block->GetSize() && block->GetSize() == largest_) {
+      largest_stale_ = true;
+    }
+    block->SetSize(size);
+    block_sizes_[block->GetSlot()] = size;
+    largest_ = std::max(largest_, size);
+  }
+};
 
-  // Create a new free block
-  FreeBlock* new_block =
-      new FreeBlock(heap_block_size - size, size, type, heap_count,
-                    allocator->GetHead(), new_heap);
+// Heaps of one type ordered by the share of their memory that is free,
+// fullest first, with a max-tree over their largest free blocks in the same
+// order
+class HeapOrder {
+ private:
+  std::vector<UINT32> heaps_;        // Heap indices, fullest first
+  std::vector<double> free_ratios_;  // Free share of each heap in heaps_
+  std::vector<UINT32> positions_;    // Position in heaps_ by heap index
+  std::vector<UINT64> heap_sizes_;   // Size by heap index
+  std::vector<UINT64> tree_;  // Max-tree, the leaves hold the largest free
+                              // block of each heap in heaps_
+  size_t leaf_count_ = 0;     // Number of leaves, a power of two
 
-  allocator->SetHead(new_block);
-  allocator->IncrementHeapCount();
+ public:
+  // Add a heap with its size and free memory
+  void Add(UINT32 heap_index, UINT64 heap_size, UINT64 free_bytes,
+           UINT64 largest) {
+    if (heap_index >= positions_.size()) {
+      positions_.resize(heap_index + 1);
+      heap_sizes_.resize(heap_index + 1);
+    }
+    if (heaps_.size() == leaf_count_) Grow();
 
-  *allocation = new Allocation(size, 0, type, heap_count, new_heap
-#ifdef DXMA_DEBUG
-                               ,
-                               file, line
-#endif
-  );
+    // An empty heap sorts last until it is moved to its place
+    heaps_.push_back(heap_index);
+    free_ratios_.push_back(1.0);
+    positions_[heap_index] = static_cast<UINT32>(heaps_.size() - 1);
+    heap_sizes_[heap_index] = heap_size;
+    Update(heap_index, free_bytes, largest);
+  }
+
+  // Remove a released heap
+  void Remove(UINT32 heap_index) {
+    size_t last = heaps_.size() - 1;
+    Move(positions_[heap_index], last);
+    heaps_.pop_back();
+    free_ratios_.pop_back();
+    SetLeaf(last, 0);
+  }
+
+  // Move a heap to its place after its free memory changed, heaps of
+  // different sizes are compared by their free share
+  void Update(UINT32 heap_index, UINT64 free_bytes, UINT64 largest) {
+    size_t pos = positions_[heap_index];
+    double free_ratio = static_cast<double>(free_bytes) /
+                        static_cast<double>(heap_sizes_[heap_index]);
+
+    // Find the place among the other heaps by binary search
+    size_t target = pos;
+    if (pos > 0 && free_ratios_[pos - 1] > free_ratio) {
+      target = std::upper_bound(free_ratios_.begin(),
+                                free_ratios_.begin() + pos, free_ratio) -
+               free_ratios_.begin();
+    } else if (pos + 1 < heaps_.size() && free_ratios_[pos + 1] < free_ratio) {
+      target = std::lower_bound(free_ratios_.begin() + pos + 1,
+                                free_ratios_.end(), free_ratio) -
+               free_ratios_.begin() - 1;
+    }
+
+    if (target != pos) Move(pos, target);
+    free_ratios_[target] = free_ratio;
+    SetLeaf(target, largest);
+  }
+
+  // Find the first position from a position on whose heap has a free block
+  // of at least size bytes, returns GetCount() if there is none
+  size_t FindFirst(UINT64 size, size_t from) const {
+    if (from >= heaps_.size() || tree_[1] < size) return heaps_.size();
+    return std::min(FindFirst(1, 0, leaf_count_, from, size), heaps_.size());
+  }
+
+  // Getters
+  size_t GetCount() const { return heaps_.size(); }
+  UINT32 GetHeapIndex(size_t pos) const { return heaps_[pos]; }
+  UINT64 GetLargestFreeBlock() const { return tree_.empty() ? 0 : tree_[1]; }
+
+ private:
+  // Double the number of leaves, so that adding heaps rebuilds the tree in
+  // amortized O(1)
+  void Grow() {
+    size_t leaf_count = leaf_count_ == 0 ? 1 : leaf_count_ * 2;
+    std::vector<UINT64> tree(leaf_count * 2, 0);
+    std::copy(tree_.begin() + leaf_count_, tree_.begin() + leaf_count_ * 2,
+              tree.begin() + leaf_count);
+    for (size_t node = leaf_count - 1; node > 0; node--) {
+      tree[node] = std::max(tree[node * 2], tree[node * 2 + 1]);
+    }
+    tree_.swap(tree);
+    leaf_count_ = leaf_count;
+  }
+
+  // Move the heap at one position to another, shifting the heaps in between
+  // by one, in O(k + log h) for k shifted heaps
+  void Move(size_t from, size_t to) {
+    size_t first = std::min(from, to);
+    size_t last = std::max(from, to) + 1;
+    size_t shift = from < to ? 1 : last - first - 1;
+    std::rotate(heaps_.begin() + first, heaps_.begin() + first + shift,
+                heaps_.begin() + last);
+    std::rotate(free_ratios_.begin() + first,
+                free_ratios_.begin() + first + shift,
+                free_ratios_.begin() + last);
+    auto leaves = tree_.begin() + leaf_count_;
+    std::rotate(leaves + first, leaves + first + shift, leaves + last);
+    for (size_t i = first; i < last; i++) {
+      positions_[heaps_[i]] = static_cast<UINT32>(i);
+    }
+
+    // Refresh the parents of the shifted leaves level by level
+    size_t begin = (leaf_count_ + first) / 2;
+    size_t end = (leaf_count_ + last - 1) / 2;
+    for (; begin > 0; begin /= 2, end /= 2) {
+      for (size_t node = begin; node <= end; node++) {
+        tree_[node] = std::max(tree_[node * 2], tree_[node * 2 + 1]);
+      }
+    }
+  }
+
+  // Set a leaf and the maximum of its parents
+  void SetLeaf(size_t pos, UINT64 largest) {
+    size_t node = leaf_count_ + pos;
+    tree_[node] = largest;
+    for (node /= 2; node > 0; node /= 2) {
+      tree_[node] = std::max(tree_[node * 2], tree_[node * 2 + 1]);
+    }
+  }
+
+  // Find the first leaf at or after from in the subtree of a node that covers
+  // [begin, end) with a value of at least size, returns leaf_count_ if none
+  size_t FindFirst(size_t node, size_t begin, size_t end, size_t from,
+                   UINT64 size) const {
+    if (end <= from || tree_[node] < size) return leaf_count_;
+    if (end - begin == 1) return begin;
+
+    size_t mid = (begin + end) / 2;
+    size_t pos = FindFirst(node * 2, begin, mid, from, size);
+    if (pos != leaf_count_) return pos;
+    return FindFirst(node * 2 + 1, mid, end, from, size);
+  }
+};
+
+// Freed range held in a quick list instead of being returned to its heap
+struct QuickRange {
+  UINT32 heap_index = 0;  // Heap of the range
+  UINT64 offset = 0;      // Offset of the range within the heap
+  UINT32 epoch = 0;       // Quick list flush during which it was added
+};
+
+// Index of the highest set bit, value must not be 0
+inline UINT32 FloorLog2(UINT64 value) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return static_cast<UINT32>(index);
+#else
+  return 63u - static_cast<UINT32>(__builtin_clzll(value));
+#endif
+}
+
+// Index of the lowest set bit, value must not be 0
+inline UINT32 CountTrailingZeros(UINT64 value) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return static_cast<UINT32>(index);
+#else
+  return static_cast<UINT32>(__builtin_ctzll(value));
+#endif
+}
+
+// Mask of the bits at and above a bit of a 64-bit word
+inline UINT64 BitsFrom(UINT64 bit) { return ~0ull << bit; }
+
+// Mask of the bits at and below a bit of a 64-bit word
+inline UINT64 BitsUpTo(UINT64 bit) {
+  return bit == 63 ? ~0ull : (1ull << (bit + 1)) - 1;
+}
+
+// Occupancy of a heap split into pages of a fixed size, with one bit per page
+// and a summary bit per 64 pages that have a free one. Replaces the FreeList
+// of heap types configured with a page size: runs of free pages are found
+// with tzcnt and lzcnt, skipping 4096 pages per summary word
+class PageBitmap {
+ private:
+  UINT32 page_shift_ = 0;  // log2 of the page size
+  UINT64 page_count_ = 0;  // Number of pages
+  std::vector<UINT64> free_;     // Bit per page, set if it is free
+  std::vector<UINT64> summary_;  // Bit per word of free_, set if not 0
+  UINT64 free_pages_ = 0;        // Number of free pages
+  UINT32 run_count_ = 0;         // Number of runs of free pages
+  mutable UINT64 largest_ = 0;   // Pages in the longest free run
+  mutable bool largest_stale_ = false;  // Whether largest_ must be rescanned
+
+ public:
+  // Make all pages of a heap free
+  void Reset(UINT64 size, UINT64 page_size) {
+    page_shift_ = FloorLog2(page_size);
+    page_count_ = size >> page_shift_;
+    free_.assign((page_count_ + 63) / 64, 0);
+    summary_.assign((free_.size() + 63) / 64, 0);
+    free_pages_ = 0;
+    run_count_ = 0;
+    largest_ = 0;
+    largest_stale_ = false;
+    if (page_count_ == 0) return;
+
+    SetRange(0, page_count_, true);
+    free_pages_ = page_count_;
+    run_count_ = 1;
+    largest_ = page_count_;
+  }
+
+  // Release the bitmap of a released heap
+  void Clear() {
+    free_.clear();
+    summary_.clear();
+    page_count_ = 0;
+    free_pages_ = 0;
+    run_count_ = 0;
+    largest_ = 0;
+    largest_stale_ = false;
+  }
+
+  // Reserve the pages of an aligned range of size bytes, from the top of the
+  // heap if top_down is set, returns false if no run of free pages fits
+  bool Allocate(UINT64 size, UINT64 alignment, bool top_down,
+                UINT64* offset) {
+    UINT64 count = ToPages(size);
+    UINT64 align = std::max<UINT64>(alignment >> page_shift_, 1);
+    if (count == 0 || count > free_pages_) return false;
+
+    UINT64 start = 0;
+    UINT64 end = 0;
+    UINT64 first = 0;
+    if (!(top_down ? FindRunFromTop(count, align, &start, &end, &first)
+                   : FindRun(count, align, &start, &end, &first))) {
+      return false;
+    }
+
+    SetRange(first, count, false);
+    free_pages_ -= count;
+    if (first > start && first + count < end) {
+      run_count_++;
+    } else if (first == start && first + count == end) {
+      run_count_--;
+    }
+    if (end - start == largest_) largest_stale_ = true;
+
+    *offset = first << page_shift_;
+    return true;
+  }
+
+  // Reserve the pages of a range that must start at offset, returns false if
+  // any of them is used
+  bool AllocateAt(UINT64 offset, UINT64 size) {
+    UINT64 first = offset >> page_shift_;
+    UINT64 count = ToPages(size);
+    if (count == 0 || first + count > page_count_ || !IsFree(first)) {
+      return false;
+    }
+
+    UINT64 end = NextUsed(first);
+    if (end < first + count) return false;
+    UINT64 start = RunStart(first);
+
+    SetRange(first, count, false);
+    free_pages_ -= count;
+    if (first > start && first + count < end) {
+      run_count_++;
+    } else if (first == start && first + count == end) {
+      run_count_--;
+    }
+    if (end - start == largest_) largest_stale_ = true;
+    return true;
+  }
+
+  // Return the pages of a range reserved with Allocate
+  void Free(UINT64 offset, UINT64 size) {
+    UINT64 first = offset >> page_shift_;
+    UINT64 count = ToPages(size);
+    bool left = first > 0 && IsFree(first - 1);
+    bool right = first + count < page_count_ && IsFree(first + count);
+
+    SetRange(first, count, true);
+    free_pages_ += count;
+    run_count_ = run_count_ + 1 - left - right;
+
+    UINT64 start = left ? RunStart(first - 1) : first;
+    UINT64 end = right ? NextUsed(first + count) : first + count;
+    largest_ = std::max(largest_, end - start);
+  }
+
+  // Call visit(offset, size) for every run of free pages
+  template <typename Visitor>
+  void ForEachFreeRange(Visitor visit) const {
+    for (UINT64 start = NextFree(0); start < page_count_;) {
+      UINT64 end = NextUsed(start);
+      visit(start << page_shift_, (end - start) << page_shift_);
+      start = NextFree(end);
+    }
+  }
+
+  // Getters
+  UINT64 GetFreeBytes() const { return free_pages_ << page_shift_; }
+  UINT32 GetBlockCount() const { return run_count_; }
+
+  // Get the size of the longest run of free pages, only rescanned after the
+  // longest run was split
+  UINT64 GetLargestFreeBlock() const {
+    if (largest_stale_) {
+      largest_ = 0;
+      ForEachFreeRange([this](UINT64, UINT64 size) {
+        largest_ = std::max(largest_, size >> page_shift_);
+      });
+      largest_stale_ = false;
+    }
+    return largest_ << page_shift_;
+  }
+
+ private:
+  // Number of pages covering size bytes
+  UINT64 ToPages(UINT64 size) const {
+    return (size + (1ull << page_shift_) - 1) >> page_shift_;
+  }
+
+  // Whether a page is free
+  bool IsFree(UINT64 page) const {
+    return (free_[page / 64] >> (page % 64)) & 1;
+  }
+
+  // Mark count pages from first as free or used and update the summary
+  void SetRange(UINT64 first, UINT64 count, bool free) {
+    UINT64 last = first + count - 1;
+    for (UINT64 word = first / 64; word <= last / 64; word++) {
+      UINT64 mask = ~0ull;
+      if (word == first / 64) mask &= BitsFrom(first % 64);
+      if (word == last / 64) mask &= BitsUpTo(last % 64);
+      free_[word] = free ? free_[word] | mask : free_[word] & ~mask;
+
+      UINT64 bit = 1ull << (word % 64);
+      summary_[word / 64] = free_[word] ? summary_[word / 64] | bit
+                                        : summary_[word / 64] & ~bit;
+    }
+  }
+
+  // Find the first free page at or after a page, page_count_ if none
+  UINT64 NextFree(UINT64 page) const {
+    if (page >= page_count_) return page_count_;
+    UINT64 word = page / 64;
+    UINT64 bits = free_[word] & BitsFrom(page % 64);
+    if (bits) return word * 64 + CountTrailingZeros(bits);
+
+    // Skip words without a free page through the summary
+    for (UINT64 next = word + 1; next < free_.size();) {
+      UINT64 summary = summary_[next / 64] & BitsFrom(next % 64);
+      if (summary) {
+        UINT64 found = next / 64 * 64 + CountTrailingZeros(summary);
+        return found * 64 + CountTrailingZeros(free_[found]);
+      }
+      next = (next / 64 + 1) * 64;
+    }
+    return page_count_;
+  }
+
+  // Find the first used page at or after a page, page_count_ if none
+  UINT64 NextUsed(UINT64 page) const {
+    for (UINT64 word = page / 64; word < free_.size(); word++) {
+      UINT64 bits = ~free_[word];
+      if (word == page / 64) bits &= BitsFrom(page % 64);
+      if (bits) return std::min(word * 64 + CountTrailingZeros(bits),
+                                page_count_);
+    }
+    return page_count_;
+  }
+
+  // Find the last free page before end, returns false if there is none
+  bool PrevFree(UINT64 end, UINT64* page) const {
+    if (end == 0) return false;
+    UINT64 word = (end - 1) / 64;
+    UINT64 bits = free_[word] & BitsUpTo((end - 1) % 64);
+    if (bits) {
+      *page = word * 64 + FloorLog2(bits);
+      return true;
+    }
+
+    // Skip words without a free page through the summary
+    for (UINT64 prev = word; prev > 0;) {
+      UINT64 summary = summary_[(prev - 1) / 64] & BitsUpTo((prev - 1) % 64);
+      if (summary) {
+        UINT64 found = (prev - 1) / 64 * 64 + FloorLog2(summary);
+        *page = found * 64 + FloorLog2(free_[found]);
+        return true;
+      }
+      prev = (prev - 1) / 64 * 64;
+    }
+    return false;
+  }
+
+  // Find the first page of the run of free pages that contains a page
+  UINT64 RunStart(UINT64 page) const {
+    for (UINT64 word = page / 64 + 1; word > 0; word--) {
+      UINT64 bits = ~free_[word - 1];
+      if (word - 1 == page / 64) bits &= BitsUpTo(page % 64);
+      if (bits) return (word - 1) * 64 + FloorLog2(bits) + 1;
+    }
+    return 0;
+  }
+
+  // Find the lowest run of free pages that holds count pages at a multiple of
+  // align pages
+  bool FindRun(UINT64 count, UINT64 align, UINT64* start, UINT64* end,
+               UINT64* first) const {
+    for (UINT64 run = NextFree(0); run < page_count_;) {
+      UINT64 run_end = NextUsed(run);
+      UINT64 aligned = (run + align - 1) / align * align;
+      if (aligned + count <= run_end) {
+        *start = run;
+        *end = run_end;
+        *first = aligned;
+        return true;
+      }
+      run = NextFree(run_end);
+    }
+    return false;
+  }
+
+  // Find the highest run of free pages that holds count pages at a multiple
+  // of align pages, the range is placed at the end of the run
+  bool FindRunFromTop(UINT64 count, UINT64 align, UINT64* start, UINT64* end,
+                      UINT64* first) const {
+    UINT64 last = 0;
+    for (UINT64 limit = page_count_; PrevFree(limit, &last);) {
+      UINT64 run = RunStart(last);
+      if (last + 1 - run >= count) {
+        UINT64 aligned = (last + 1 - count) / align * align;
+        if (aligned >= run) {
+          *start = run;
+          *end = last + 1;
+          *first = aligned;
+          return true;
+        }
+      }
+      limit = run;
+    }
+    return false;
+  }
+};
+
+#if defined(DXMA_TIMING) || defined(DXMA_TRACE) || defined(DXMA_JOURNAL) || \
+    defined(DXMA_SHARED_STATS)
+// Current time of the monotonic clock in nanoseconds
+inline UINT64 TimingNow() {
+  return static_cast<UINT64>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+#endif
+
+#ifdef DXMA_TIMING
+// Lock-free log2 latency histogram, safe to record and read concurrently
+class TimingHistogram {
+ private:
+  std::atomic<UINT64> count_{0};     // Number of samples
+  std::atomic<UINT64> total_ns_{0};  // Sum of all samples
+  std::atomic<UINT64> max_ns_{0};    // Slowest sample
+  std::atomic<UINT64> buckets_[DXMA_TIMING_BUCKET_COUNT]{};  // Log2 buckets
+
+ public:
+  // Record a single sample
+  void Record(UINT64 ns) {
+    UINT32 bucket = ns == 0 ? 0 : FloorLog2(ns);
+    if (bucket >= DXMA_TIMING_BUCKET_COUNT) {
+      bucket = DXMA_TIMING_BUCKET_COUNT - 1;
+    }
+
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_ns_.fetch_add(ns, std::memory_order_relaxed);
+
+    UINT64 max_ns = max_ns_.load(std::memory_order_relaxed);
+    while (ns > max_ns && !max_ns_.compare_exchange_weak(
+                              max_ns, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  // Copy the current state into a user visible histogram
+  void Read(DxmaTimingHistogram* histogram) const {
+    histogram->count = count_.load(std::memory_order_relaxed);
+    histogram->total_ns = total_ns_.load(std::memory_order_relaxed);
+    histogram->max_ns = max_ns_.load(std::memory_order_relaxed);
+    for (UINT32 i = 0; i < DXMA_TIMING_BUCKET_COUNT; i++) {
+      histogram->buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  // Clear all samples
+  void Reset() {
+    count_.store(0, std::memory_order_relaxed);
+    total_ns_.store(0, std::memory_order_relaxed);
+    max_ns_.store(0, std::memory_order_relaxed);
+    for (UINT32 i = 0; i < DXMA_TIMING_BUCKET_COUNT; i++) {
+      buckets_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+// Start measuring a sequence of phases
+#define DXMA_TIMING_START(timer) UINT64 timer = dxma_detail::TimingNow()
+
+// Record the time since the last start or lap and restart the timer
+#define DXMA_TIMING_LAP(allocator, phase, timer)                \
+  do {                                                          \
+    UINT64 dxma_timing_now = dxma_detail::TimingNow();          \
+    (allocator)->RecordTiming(phase, dxma_timing_now - (timer)); \
+    (timer) = dxma_timing_now;                                  \
+  } while (0)
+#else
+#define DXMA_TIMING_START(timer)
+#define DXMA_TIMING_LAP(allocator, phase, timer)
+#endif
+
+#ifdef DXMA_TRACE
+// Single allocator event written by the trace sink
+struct TraceEvent {
+  const char* name = nullptr;  // Event name shown on the timeline
+  UINT64 start_ns = 0;         // Start time in nanoseconds
+  UINT64 duration_ns = 0;      // Duration in nanoseconds
+  UINT64 size = 0;             // Size of the allocation or heap
+  D3D12_HEAP_TYPE heap_type = D3D12_HEAP_TYPE_DEFAULT;  // Type of heap
+  UINT32 heap_index = 0;                                // Index of the heap
+};
+
+// Writes allocator events as Chrome trace-event JSON, events are buffered per
+// thread and written to the file by a background thread
+class TraceSink {
+ private:
+  // Events recorded by one thread since the last flush
+  struct ThreadBuffer {
+    std::mutex mutex;                // Guards events against the flush thread
+    std::vector<TraceEvent> events;  // Pending events
+    UINT32 thread_index = 0;         // Thread id written to the trace
+    std::thread::id thread_id;       // Owning thread
+  };
+
+  // Last buffer used by the calling thread
+  struct ThreadCache {
+    UINT64 sink_id = 0;              // Sink the buffer belongs to
+    ThreadBuffer* buffer = nullptr;  // Buffer of the calling thread
+  };
+
+  static std::atomic<UINT64>& NextSinkId() {
+    static std::atomic<UINT64> next_sink_id{1};
+    return next_sink_id;
+  }
+
+  UINT64 id_ = NextSinkId().fetch_add(1);  // Unique id of this sink
+  FILE* file_ = nullptr;                   // Output file
+  UINT64 long_allocation_ns_ = 0;  // Threshold for allocation events
+  bool first_event_ = true;        // Whether no event was written yet
+  bool stop_ = false;              // Whether the flush thread should stop
+
+  std::mutex buffers_mutex_;  // Guards buffers_
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;  // One per thread
+
+  std::mutex flush_mutex_;                  // Guards stop_
+  std::condition_variable flush_condition_;  // Wakes the flush thread
+  std::thread flush_thread_;                 // Background writer
+
+  // Get the buffer of the calling thread, creating it on first use
+  ThreadBuffer* GetThreadBuffer() {
+    thread_local ThreadCache cache;
+    if (cache.sink_id == id_) return cache.buffer;
+
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    std::thread::id thread_id = std::this_thread::get_id();
+
+    ThreadBuffer* buffer = nullptr;
+    for (const std::unique_ptr<ThreadBuffer>& existing : buffers_) {
+      if (existing->thread_id == thread_id) buffer = existing.get();
+    }
+
+    if (!buffer) {
+      buffers_.push_back(std::make_unique<ThreadBuffer>());
+      buffer = buffers_.back().get();
+      buffer->thread_index = static_cast<UINT32>(buffers_.size());
+      buffer->thread_id = thread_id;
+    }
+
+    cache.sink_id = id_;
+    cache.buffer = buffer;
+    return buffer;
+  }
+
+  // Write all buffered events to the file (flush thread only)
+  void Flush() {
+    std::vector<TraceEvent> events;
+
+    std::lock_guard<std::mutex> buffers_lock(buffers_mutex_);
+    for (const std::unique_ptr<ThreadBuffer>& buffer : buffers_) {
+      {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        events.swap(buffer->events);
+      }
+
+      for (const TraceEvent& event : events) {
+        std::fprintf(file_,
+                     "%s{\"name\":\"%s\",\"cat\":\"dxma\",\"ph\":\"X\","
+                     "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,"
+                     "\"args\":{\"size\":%llu,\"heapType\":%d,"
+                     "\"heapIndex\":%u}}",
+                     first_event_ ? "\n" : ",\n", event.name,
+                     event.start_ns / 1000.0, event.duration_ns / 1000.0,
+                     buffer->thread_index,
+                     static_cast<unsigned long long>(event.size),
+                     static_cast<int>(event.heap_type), event.heap_index);
+        first_event_ = false;
+      }
+      events.clear();
+    }
+    std::fflush(file_);
+  }
+
+  // Background loop writing events every DXMA_TRACE_FLUSH_INTERVAL_MS
+  void FlushLoop() {
+    std::unique_lock<std::mutex> lock(flush_mutex_);
+    while (!stop_) {
+      flush_condition_.wait_for(
+          lock, std::chrono::milliseconds(DXMA_TRACE_FLUSH_INTERVAL_MS));
+      Flush();
+    }
+    Flush();
+  }
+
+ public:
+  TraceSink(FILE* file, UINT64 long_allocation_ns)
+      : file_(file), long_allocation_ns_(long_allocation_ns) {
+    std::fputs("{\"traceEvents\":[", file_);
+    flush_thread_ = std::thread(&TraceSink::FlushLoop, this);
+  }
+
+  ~TraceSink() {
+    {
+      std::lock_guard<std::mutex> lock(flush_mutex_);
+      stop_ = true;
+    }
+    flush_condition_.notify_one();
+    flush_thread_.join();
+
+    std::fputs("\n],\"displayTimeUnit\":\"ns\"}\n", file_);
+    std::fclose(file_);
+  }
+
+  TraceSink(const TraceSink&) = delete;
+  TraceSink& operator=(const TraceSink&) = delete;
+
+  // Get the minimum duration of allocations that are recorded
+  UINT64 GetLongAllocationThreshold() const { return long_allocation_ns_; }
+
+  // Record an event from the calling thread
+  void Record(const TraceEvent& event) {
+    ThreadBuffer* buffer = GetThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->events.push_back(event);
+  }
+};
+#endif
+
+#ifdef DXMA_PROFILING
+// Capture the call stack with the platform unwinder
+inline UINT32 CaptureStack(void** frames, UINT32 max_frames, void*) {
+#if defined(_WIN32)
+  return CaptureStackBackTrace(0, max_frames, frames, nullptr);
+#elif defined(DXMA_HAS_EXECINFO)
+  int frame_count = backtrace(frames, static_cast<int>(max_frames));
+  return frame_count > 0 ? static_cast<UINT32>(frame_count) : 0;
+#else
+  return 0;
+#endif
+}
+
+// Samples on average one allocation per sample interval bytes and attributes
+// the live memory of sampled allocations to their call stacks
+class SamplingProfiler {
+ private:
+  UINT64 sample_interval_ = 0;     // Mean bytes between samples (0 = off)
+  int64_t bytes_until_sample_ = 0;  // Bytes left until the next sample
+  UINT64 random_state_ = 0x9E3779B97F4A7C15ull;  // State of the random numbers
+  PFN_dxmaCaptureStack capture_stack_ = CaptureStack;  // Stack capture
+  void* capture_user_data_ = nullptr;  // User data passed to capture_stack_
+  std::vector<DxmaStackReport> stacks_;  // Sampled stacks, index is id - 1
+  std::unordered_map<UINT64, UINT32> stack_ids_;  // Stack hash to stack id
+
+  // Draw an exponentially distributed distance to the next sample, so sampling
+  // does not alias with periodic allocation patterns
+  int64_t NextSampleDistance() {
+    random_state_ ^= random_state_ >> 12;
+    random_state_ ^= random_state_ << 25;
+    random_state_ ^= random_state_ >> 27;
+    UINT64 bits = random_state_ * 0x2545F4914F6CDD1Dull;
+
+    double uniform = static_cast<double>((bits >> 11) + 1) / 9007199254740992.0;
+    return static_cast<int64_t>(-std::log(uniform) * sample_interval_) + 1;
+  }
+
+  // Get the id of a call stack, adding it if it was not sampled before
+  UINT32 FindOrAddStack(void* const* frames, UINT32 frame_count) {
+    UINT64 hash = 14695981039346656037ull;
+    for (UINT32 i = 0; i < frame_count; i++) {
+      hash ^= static_cast<UINT64>(reinterpret_cast<uintptr_t>(frames[i]));
+      hash *= 1099511628211ull;
+    }
+
+    // Different stacks with the same hash probe the following hash values
+    for (;; hash++) {
+      auto it = stack_ids_.find(hash);
+      if (it == stack_ids_.end()) break;
+
+      const DxmaStackReport& stack = stacks_[it->second - 1];
+      if (stack.frame_count == frame_count &&
+          std::equal(frames, frames + frame_count, stack.frames)) {
+        return it->second;
+      }
+    }
+
+    DxmaStackReport stack;
+    stack.frame_count = frame_count;
+    std::copy(frames, frames + frame_count, stack.frames);
+    stacks_.push_back(stack);
+
+    UINT32 id = static_cast<UINT32>(stacks_.size());
+    stack_ids_.emplace(hash, id);
+    return id;
+  }
+
+ public:
+  // Set the sample interval and stack capture, an interval of 0 stops sampling
+  // new allocations
+  void Configure(UINT64 sample_interval, PFN_dxmaCaptureStack capture_stack,
+                 void* user_data) {
+    sample_interval_ = sample_interval;
+    capture_stack_ = capture_stack ? capture_stack : CaptureStack;
+    capture_user_data_ = user_data;
+    bytes_until_sample_ = sample_interval_ ? NextSampleDistance() : 0;
+  }
+
+  // Sample the allocation if the sample interval elapsed
+  void OnAllocate(Allocation* allocation) {
+    if (sample_interval_ == 0) return;
+
+    bytes_until_sample_ -= static_cast<int64_t>(allocation->GetSize());
+    if (bytes_until_sample_ > 0) return;
+    bytes_until_sample_ = NextSampleDistance();
+
+    void* frames[DXMA_PROFILING_MAX_FRAMES];
+    UINT32 frame_count =
+        capture_stack_(frames, DXMA_PROFILING_MAX_FRAMES, capture_user_data_);
+    if (frame_count > DXMA_PROFILING_MAX_FRAMES) {
+      frame_count = DXMA_PROFILING_MAX_FRAMES;
+    }
+
+    // A sample of size bytes is taken with probability 1 - e^(-size/interval),
+    // dividing by it gives an unbiased estimate of the bytes it represents
+    double size = static_cast<double>(allocation->GetSize());
+    UINT64 bytes = static_cast<UINT64>(
+        size / (1.0 - std::exp(-size / static_cast<double>(sample_interval_))));
+
+    UINT32 id = FindOrAddStack(frames, frame_count);
+    stacks_[id - 1].live_bytes += bytes;
+    stacks_[id - 1].live_allocations++;
+    allocation->SetSample(id, bytes);
+  }
+
+  // Scale the bytes a sampled allocation represents to its new size
+  void OnResize(Allocation* allocation, UINT64 old_size) {
+    UINT32 id = allocation->GetSampleStack();
+    if (id == 0) return;
+
+    UINT64 old_bytes = allocation->GetSampleBytes();
+    UINT64 bytes = static_cast<UINT64>(
+        static_cast<double>(old_bytes) *
+        static_cast<double>(allocation->GetSize()) /
+        static_cast<double>(old_size));
+    stacks_[id - 1].live_bytes = stacks_[id - 1].live_bytes - old_bytes + bytes;
+    allocation->SetSample(id, bytes);
+  }
+
+  // Remove a freed allocation from its call stack
+  void OnFree(Allocation* allocation) {
+    UINT32 id = allocation->GetSampleStack();
+    if (id == 0) return;
+
+    stacks_[id - 1].live_bytes -= allocation->GetSampleBytes();
+    stacks_[id - 1].live_allocations--;
+    allocation->SetSample(0, 0);
+  }
+
+  // Write the call stacks with the most live bytes, largest first, and return
+  // the number of reports written
+  UINT32 GetTopStacks(DxmaStackReport* reports, UINT32 max_reports) const {
+    std::vector<UINT32> order;
+    for (UINT32 i = 0; i < stacks_.size(); i++) {
+      if (stacks_[i].live_allocations > 0) order.push_back(i);
+    }
+
+    UINT32 count = static_cast<UINT32>(
+        std::min<size_t>(max_reports, order.size()));
+    std::partial_sort(order.begin(), order.begin() + count, order.end(),
+                      [this](UINT32 a, UINT32 b) {
+                        return stacks_[a].live_bytes > stacks_[b].live_bytes;
+                      });
+
+    for (UINT32 i = 0; i < count; i++) {
+      reports[i] = stacks_[order[i]];
+    }
+    return count;
+  }
+};
+#endif
+
+// Stores each distinct string once, in chunks that live as long as the arena
+class StringArena {
+ private:
+  static constexpr size_t kChunkSize = 4096;  // Minimum size of a chunk
+
+  std::vector<std::unique_ptr<char[]>> chunks_;  // Allocated chunks
+  size_t chunk_used_ = kChunkSize;  // Bytes used in the last chunk
+  size_t chunk_size_ = kChunkSize;  // Size of the last chunk
+  std::unordered_map<std::string_view, const char*>
+      strings_;  // Interned strings
+
+ public:
+  // Get the interned copy of a string, copying it on first use
+  const char* Intern(const char* string) {
+    std::string_view view(string);
+    auto it = strings_.find(view);
+    if (it != strings_.end()) return it->second;
+
+    size_t size = view.size() + 1;
+    if (chunk_used_ + size > chunk_size_) {
+      chunk_size_ = std::max(kChunkSize, size);
+      chunks_.push_back(std::make_unique<char[]>(chunk_size_));
+      chunk_used_ = 0;
+    }
+
+    char* copy = chunks_.back().get() + chunk_used_;
+    std::copy(view.begin(), view.end(), copy);
+    copy[view.size()] = '\0';
+    chunk_used_ += size;
+
+    strings_.emplace(std::string_view(copy, view.size()), copy);
+    return copy;
+  }
+};
+
+// Index of a heap type into per-type statistics
+inline UINT32 HeapTypeIndex(D3D12_HEAP_TYPE type) {
+  UINT32 index = static_cast<UINT32>(type);
+  return index < DXMA_HEAP_TYPE_COUNT ? index : 0;
+}
+
+#if defined(DXMA_JOURNAL) || defined(DXMA_SHARED_STATS)
+// File mapped into memory, its contents survive a crash of the process
+class MappedFile {
+ private:
+#ifdef _WIN32
+  HANDLE file_ = INVALID_HANDLE_VALUE;  // Handle of the file
+  HANDLE mapping_ = nullptr;            // Handle of the file mapping
+#endif
+  void* data_ = nullptr;  // Mapped view of the file
+  UINT64 size_ = 0;       // Size of the mapped view
+
+ public:
+  MappedFile() = default;
+  ~MappedFile() { Close(); }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Create or truncate a file of the given size and map it, the contents are
+  // zero-initialized
+  bool Open(const char* path, UINT64 size) {
+    Close();
+#ifdef _WIN32
+    file_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                        nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) return false;
+
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE,
+                                  static_cast<DWORD>(size >> 32),
+                                  static_cast<DWORD>(size), nullptr);
+    if (!mapping_) {
+      Close();
+      return false;
+    }
+
+    data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0,
+                          static_cast<SIZE_T>(size));
+#else
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      close(fd);
+      return false;
+    }
+
+    data_ = mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+    close(fd);
+    if (data_ == MAP_FAILED) data_ = nullptr;
+#endif
+    if (!data_) {
+      Close();
+      return false;
+    }
+
+    size_ = size;
+    return true;
+  }
+
+  // Write the contents back to the file and unmap it
+  void Close() {
+#ifdef _WIN32
+    if (data_) {
+      FlushViewOfFile(data_, 0);
+      UnmapViewOfFile(data_);
+    }
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+    mapping_ = nullptr;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (data_) {
+      msync(data_, static_cast<size_t>(size_), MS_SYNC);
+      munmap(data_, static_cast<size_t>(size_));
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  // Get the mapped contents
+  void* GetData() const { return data_; }
+};
+#endif
+
+#ifdef DXMA_JOURNAL
+// Ring of recent allocator events in a memory-mapped file, so the events and
+// the heap layout can be read after a crash or device removal. The counters
+// are not atomic, all calls must hold the allocator lock (or come from its
+// only thread with NoLock)
+class Journal {
+ private:
+  MappedFile file_;                        // Mapped journal file
+  DxmaJournalHeader* header_ = nullptr;    // Header of the journal
+  DxmaJournalHeap* heaps_ = nullptr;       // Heap table
+  DxmaJournalRecord* records_ = nullptr;   // Record ring
+  UINT64 live_allocations_ = 0;            // Number of live allocations
+  UINT64 live_bytes_[DXMA_HEAP_TYPE_COUNT]{};  // Live bytes per heap type
+  UINT32 records_since_summary_ = 0;  // Records appended since the summary
+  UINT32 id_ = 0;  // Id marking the allocations recorded by this journal
+
+ public:
+  Journal() {
+    static std::atomic<UINT32> next_id{0};
+    id_ = next_id.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  // Create the journal file with room for heap_capacity heaps and
+  // record_count records
+  bool Open(const char* path, UINT32 heap_capacity, UINT64 record_count) {
+    if (record_count == 0) return false;
+
+    UINT64 size = sizeof(DxmaJournalHeader) +
+                  heap_capacity * sizeof(DxmaJournalHeap) +
+                  record_count * sizeof(DxmaJournalRecord);
+    if (!file_.Open(path, size)) return false;
+
+    header_ = static_cast<DxmaJournalHeader*>(file_.GetData());
+    heaps_ = reinterpret_cast<DxmaJournalHeap*>(header_ + 1);
+    records_ = reinterpret_cast<DxmaJournalRecord*>(heaps_ + heap_capacity);
+    header_->magic = DXMA_JOURNAL_MAGIC;
+    header_->version = DXMA_JOURNAL_VERSION;
+    header_->record_count = record_count;
+    header_->heap_capacity = heap_capacity;
+    return true;
+  }
+
+  ~Journal() {
+    if (header_) WriteSummary();
+  }
+
+  // Append a record with the allocator lock held, a record is only valid for
+  // readers of the file once its sequence is stored
+  void Append(DxmaJournalEvent event, D3D12_HEAP_TYPE heap_type,
+              UINT32 heap_index, UINT64 offset, UINT64 size) {
+    UINT64 sequence =
+        header_->next_sequence.fetch_add(1, std::memory_order_relaxed) + 1;
+    DxmaJournalRecord& record =
+        records_[(sequence - 1) % header_->record_count];
+
+    // Invalidate the record while it is written
+    record.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record.time_ns = TimingNow();
+    record.offset = offset;
+    record.size = size;
+    record.heap_index = heap_index;
+    record.heap_type = static_cast<UINT16>(heap_type);
+    record.event = event;
+    record.sequence.store(sequence, std::memory_order_release);
+
+    if (++records_since_summary_ >= DXMA_JOURNAL_SUMMARY_INTERVAL) {
+      WriteSummary();
+    }
+  }
+
+  // Record a new heap in the header and the ring
+  void OnCreateHeap(UINT32 heap_index, D3D12_HEAP_TYPE type, UINT64 size) {
+    if (heap_index < header_->heap_capacity) {
+      DxmaJournalHeap& heap = heaps_[heap_index];
+      heap.size = size;
+      heap.type = static_cast<UINT32>(type);
+      heap.used = 1;
+      header_->heap_count = std::max(header_->heap_count, heap_index + 1);
+    }
+    Append(DXMA_JOURNAL_EVENT_CREATE_HEAP, type, heap_index, 0, size);
+  }
+
+  // Record a released heap, its slot may be reused by a later heap
+  void OnReleaseHeap(UINT32 heap_index, D3D12_HEAP_TYPE type, UINT64 size) {
+    if (heap_index < header_->heap_capacity) heaps_[heap_index].used = 0;
+    Append(DXMA_JOURNAL_EVENT_RELEASE_HEAP, type, heap_index, 0, size);
+  }
+
+  // Record a new allocation
+  void OnAllocate(Allocation* allocation) {
+    allocation->SetJournalId(id_);
+    live_allocations_++;
+    live_bytes_[HeapTypeIndex(allocation->GetHeapType())] +=
+        allocation->GetSize();
+    Append(DXMA_JOURNAL_EVENT_ALLOCATE, allocation->GetHeapType(),
+           allocation->GetHeapIndex(), allocation->GetOffset(),
+           allocation->GetSize());
+  }
+
+  // Record a freed allocation, allocations made before the journal was
+  // opened are not part of its live totals
+  void OnFree(Allocation* allocation) {
+    if (allocation->GetJournalId() == id_) {
+      allocation->SetJournalId(0);
+      live_allocations_--;
+      live_bytes_[HeapTypeIndex(allocation->GetHeapType())] -=
+          allocation->GetSize();
+    }
+    Append(DXMA_JOURNAL_EVENT_FREE, allocation->GetHeapType(),
+           allocation->GetHeapIndex(), allocation->GetOffset(),
+           allocation->GetSize());
+  }
+
+  // Record the new size of a resized allocation
+  void OnResize(const Allocation* allocation, UINT64 old_size) {
+    if (allocation->GetJournalId() == id_) {
+      UINT64& live_bytes =
+          live_bytes_[HeapTypeIndex(allocation->GetHeapType())];
+      live_bytes = live_bytes - old_size + allocation->GetSize();
+    }
+    Append(DXMA_JOURNAL_EVENT_RESIZE, allocation->GetHeapType(),
+           allocation->GetHeapIndex(), allocation->GetOffset(),
+           allocation->GetSize());
+  }
+
+  // Copy the live totals into the header, guarded by an odd sequence while
+  // the summary is incomplete
+  void WriteSummary() {
+    UINT64 sequence = header_->summary_sequence.load(std::memory_order_relaxed);
+    header_->summary_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    header_->summary_time_ns = TimingNow();
+    header_->summary_record =
+        header_->next_sequence.load(std::memory_order_relaxed);
+    header_->live_allocations = live_allocations_;
+    for (UINT32 i = 0; i < DXMA_HEAP_TYPE_COUNT; i++) {
+      header_->live_bytes[i] = live_bytes_[i];
+    }
+
+    header_->summary_sequence.store(sequence + 2, std::memory_order_release);
+    records_since_summary_ = 0;
+  }
+};
+#endif
+
+#ifdef DXMA_SHARED_STATS
+// Statistics in a memory-mapped region, written under a seqlock so another
+// process can sample them without synchronizing with the allocator
+class SharedStats {
+ private:
+  MappedFile file_;                            // Mapped region
+  DxmaSharedStatsRegion* region_ = nullptr;    // Region header and stats
+  DxmaSharedStats stats_{};                    // Stats owned by the allocator
+
+ public:
+  // Create the region at path, /dev/shm paths are backed by shared memory
+  bool Open(const char* path) {
+    if (!file_.Open(path, sizeof(DxmaSharedStatsRegion))) return false;
+
+    region_ = static_cast<DxmaSharedStatsRegion*>(file_.GetData());
+    region_->magic = DXMA_SHARED_STATS_MAGIC;
+    region_->version = DXMA_SHARED_STATS_VERSION;
+    return true;
+  }
+
+  // Get the stats owned by the allocator, Publish makes changes visible
+  DxmaSharedStats& GetStats() { return stats_; }
+
+  // Copy the stats into the region
+  void Publish() {
+    stats_.update_count++;
+    stats_.time_ns = TimingNow();
+
+    UINT64 sequence = region_->sequence.load(std::memory_order_relaxed);
+    region_->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    region_->stats = stats_;
+    region_->sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+  // Copy the heap and allocation counts of the allocator, Publish makes them
+  // visible
+  void UpdateCounts(const DxmaHeapTypeStats* type_stats) {
+    stats_.heap_count = 0;
+    stats_.allocation_count = 0;
+    for (UINT32 i = 0; i < DXMA_HEAP_TYPE_COUNT; i++) {
+      DxmaSharedTypeStats& shared_type_stats = stats_.types[i];
+      shared_type_stats.heap_count = type_stats[i].heap_count;
+      shared_type_stats.heap_bytes = type_stats[i].heap_bytes;
+      shared_type_stats.allocation_count = type_stats[i].allocation_count;
+      shared_type_stats.allocation_bytes = type_stats[i].allocation_bytes;
+      stats_.heap_count += type_stats[i].heap_count;
+      stats_.allocation_count += type_stats[i].allocation_count;
+    }
+  }
+
+  // Recompute the free block statistics from the free memory of all heaps,
+  // released heap slots have none
+  template <typename HeapSource>
+  void UpdateFreeBlocks(const HeapSource& heaps) {
+    for (DxmaSharedTypeStats& type_stats : stats_.types) {
+      type_stats.free_block_count = 0;
+      type_stats.free_bytes = 0;
+      type_stats.largest_free_block = 0;
+    }
+
+    for (UINT32 i = 0; i < heaps.GetHeapCount(); i++) {
+      DxmaSharedTypeStats& type_stats =
+          stats_.types[HeapTypeIndex(heaps.GetHeapType(i))];
+      type_stats.free_block_count += heaps.GetHeapFreeBlockCount(i);
+      type_stats.free_bytes += heaps.GetHeapFreeBytes(i);
+      type_stats.largest_free_block = std::max(
+          type_stats.largest_free_block, heaps.GetHeapLargestFreeBlock(i));
+    }
+
+    for (DxmaSharedTypeStats& type_stats : stats_.types) {
+      type_stats.fragmentation =
+          type_stats.free_bytes
+              ? 1.0 - static_cast<double>(type_stats.largest_free_block) /
+                          static_cast<double>(type_stats.free_bytes)
+              : 0.0;
+    }
+  }
+};
+#endif
+
+#ifdef DXMA_DEBUG
+// Byte written to corruption detection margins
+constexpr UINT8 kMarginPattern = 0xDC;
+
+// Byte written to freed memory of CPU-visible heaps
+constexpr UINT8 kFreedPattern = 0xDD;
+
+// Whether memory of a heap type can be mapped for CPU access
+inline bool IsCpuVisible(D3D12_HEAP_TYPE type) {
+  return type == D3D12_HEAP_TYPE_UPLOAD || type == D3D12_HEAP_TYPE_READBACK;
+}
+
+// Whether every byte of a range equals the pattern, compared 16 bytes at a
+// time with SSE2 where available
+inline bool IsFilled(const UINT8* data, UINT64 size, UINT8 pattern) {
+  UINT64 i = 0;
+#ifdef DXMA_HAS_SSE2
+  const __m128i expected = _mm_set1_epi8(static_cast<char>(pattern));
+  for (; i + 16 <= size; i += 16) {
+    __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, expected)) != 0xFFFF) {
+      return false;
+    }
+  }
+#endif
+  for (; i < size; i++) {
+    if (data[i] != pattern) return false;
+  }
+  return true;
+}
+
+// Call site of dxmaAllocate, identified by the __FILE__ pointer and line
+struct CallSiteKey {
+  const char* file;  // File of the call site
+  int line;          // Line of the call site
+
+  bool operator==(const CallSiteKey& other) const {
+    return file == other.file && line == other.line;
+  }
+};
+
+// Hash function for call sites (used in debug mode)
+struct CallSiteKeyHasher {
+  size_t operator()(const CallSiteKey& key) const {
+    size_t hf = std::hash<const char*>{}(key.file);
+    size_t hl = std::hash<int>{}(key.line);
+    return hf ^ (hl << 1);
+  }
+};
+#endif
+
+// Uses the first free block that is large enough, in the first heap that
+// has one
+struct FirstFit {
+  static constexpr bool kFirstMatch = true;  // Stop at the first heap
+
+  // Find a free block with room for an aligned range of size bytes
+  static FreeBlock* Find(const FreeList& list, UINT64 size,
+                         UINT64 alignment) {
+    for (FreeBlock* ptr = list.GetHead(); ptr; ptr = ptr->GetNext()) {
+      if (Fits(ptr, size, alignment)) return ptr;
+    }
+    return nullptr;
+  }
+};
+
+// Uses the smallest free block that is large enough across all heaps, which
+// keeps large blocks intact at the cost of always scanning every list. The
+// scan runs over the flat size array of each list instead of its blocks
+struct BestFit {
+  static constexpr bool kFirstMatch = false;  // Compare all heaps
+
+  // Find a free block with room for an aligned range of size bytes
+  static FreeBlock* Find(const FreeList& list, UINT64 size,
+                         UINT64 alignment) {
+    return list.FindSmallest(size, alignment);
+  }
+};
+
+// Uses the free block with the highest offset that is large enough, used to
+// place transient allocations from the top of heaps
+struct LastFit {
+  static constexpr bool kFirstMatch = true;  // Stop at the first heap
+
+  // Find a free block with room for an aligned range of size bytes
+  static FreeBlock* Find(const FreeList& list, UINT64 size,
+                         UINT64 alignment) {
+    FreeBlock* last = nullptr;
+    for (FreeBlock* ptr = list.GetHead(); ptr; ptr = ptr->GetNext()) {
+      if (Fits(ptr, size, alignment)) last = ptr;
+    }
+    return last;
+  }
+};
+
+// Performs no locking, the allocator must only be used by one thread at a time
+struct NoLock {
+  void lock() {}
+  void unlock() {}
+};
+
+// Serializes dxmaAllocate and dxmaFree with a mutex
+class MutexLock {
+ private:
+  std::mutex mutex_;  // Guards the free block list and heaps
+
+ public:
+  void lock() { mutex_.lock(); }
+  void unlock() { mutex_.unlock(); }
+};
+
+// Tracks live allocations for leak reports, enumeration, snapshots and call
+// sites (debug mode only)
+struct DebugTracking {
+  static constexpr bool kEnabled = true;
+};
+
+// Does not track live allocations
+struct NoTracking {
+  static constexpr bool kEnabled = false;
+};
+
+// Keeps tag, heap type and frame statistics
+struct BasicStats {
+  static constexpr bool kEnabled = true;
+};
+
+// Keeps no statistics
+struct NoStats {
+  static constexpr bool kEnabled = false;
+};
+
+// Offset allocator over the range [base, base + size) without a heap,
+// sharing the free block index of the heaps of BasicAllocator
+template <typename FitPolicy>
+class BasicVirtualBlock {
+ private:
+  UINT64 size_ = 0;      // Size of the managed range
+  UINT64 base_ = 0;      // First offset of the managed range
+  FreeList free_list_;   // Free ranges
+  std::unordered_map<UINT64, UINT64> allocations_;  // Size by offset
+  UINT64 allocated_bytes_ = 0;  // Size of all allocations
+
+ public:
+  explicit BasicVirtualBlock(UINT64 size, UINT64 base = 0)
+      : size_(size), base_(base) {
+    free_list_.Reset(size, D3D12_HEAP_TYPE_DEFAULT, 0, nullptr, base);
+  }
+
+  // Reserve size bytes at an offset aligned to a power of two alignment,
+  // returns false if no free range is large enough
+  bool Allocate(UINT64 size, UINT64 alignment, UINT64* offset) {
+    if (size == 0) return false;
+
+    FreeBlock* block = FitPolicy::Find(free_list_, size, alignment);
+    if (!block) return false;
+
+    // The alignment padding stays free, only size bytes are reserved
+    *offset = free_list_.Split(block, size, alignment);
+    allocations_[*offset] = size;
+    allocated_bytes_ += size;
+    return true;
+  }
+
+  // Return an allocation made at offset, returns false for unknown offsets
+  bool Free(UINT64 offset) {
+    auto it = allocations_.find(offset);
+    if (it == allocations_.end()) return false;
+
+    UINT64 size = it->second;
+    allocations_.erase(it);
+    allocated_bytes_ -= size;
+    free_list_.Insert(free_list_.FindPrevious(offset), offset, size,
+                      D3D12_HEAP_TYPE_DEFAULT, 0, nullptr);
+    return true;
+  }
+
+  // Return all allocations at once
+  void Clear() {
+    allocations_.clear();
+    allocated_bytes_ = 0;
+    free_list_.Reset(size_, D3D12_HEAP_TYPE_DEFAULT, 0, nullptr, base_);
+  }
+
+  // Get the size of an allocation, or 0 for unknown offsets
+  UINT64 GetAllocationSize(UINT64 offset) const {
+    auto it = allocations_.find(offset);
+    return it == allocations_.end() ? 0 : it->second;
+  }
+
+  // Get the usage and free ranges of the block
+  void GetStats(DxmaVirtualBlockStats* stats) const {
+    stats->size = size_;
+    stats->allocation_count = allocations_.size();
+    stats->allocated_bytes = allocated_bytes_;
+    stats->free_block_count = free_list_.GetBlockCount();
+    stats->free_bytes = free_list_.GetFreeBytes();
+    stats->largest_free_block = free_list_.GetLargestFreeBlock();
+  }
+
+  // Getters
+  UINT64 GetSize() const { return size_; }
+  const FreeList& GetFreeList() const { return free_list_; }
+};
+
+#ifdef DXMA_TRACE
+// Records an allocation event if dxmaAllocate took longer than the threshold
+class TraceAllocationScope {
+ private:
+  TraceSink* sink_ = nullptr;                 // Active trace sink
+  const DxmaAllocationInfo& alloc_info_;      // Requested allocation
+  Allocation** allocation_ = nullptr;         // Result of the allocation
+  Allocation* initial_allocation_ = nullptr;  // Value before allocating
+  UINT64 start_ns_ = 0;                       // Start time
+
+ public:
+  TraceAllocationScope(TraceSink* sink, const DxmaAllocationInfo& alloc_info,
+                       Allocation** allocation)
+      : sink_(sink),
+        alloc_info_(alloc_info),
+        allocation_(allocation) {
+    if (!sink_) return;
+    initial_allocation_ = *allocation;
+    start_ns_ = TimingNow();
+  }
+
+  ~TraceAllocationScope() {
+    if (!sink_) return;
+
+    UINT64 duration_ns = TimingNow() - start_ns_;
+    if (duration_ns < sink_->GetLongAllocationThreshold()) return;
+
+    TraceEvent event;
+    event.name = "Allocate";
+    event.start_ns = start_ns_;
+    event.duration_ns = duration_ns;
+    event.size = alloc_info_.size;
+    event.heap_type = alloc_info_.type;
+    if (*allocation_ != initial_allocation_ && *allocation_) {
+      event.heap_index = (*allocation_)->GetHeapIndex();
+    } else {
+      event.name = "AllocateFailed";
+    }
+    sink_->Record(event);
+  }
+
+  TraceAllocationScope(const TraceAllocationScope&) = delete;
+  TraceAllocationScope& operator=(const TraceAllocationScope&) = delete;
+};
+#endif
+
+// Main allocator class for managing memory allocations, the policies select
+// the features compiled into dxmaAllocate and dxmaFree
+template <typename FitPolicy, typename LockPolicy, typename TrackingPolicy,
+          typename StatsPolicy>
+class BasicAllocator {
+ private:
+  LockPolicy lock_;                 // Guards allocate and free
+  ID3D12Device* device_ = nullptr;  // Pointer to the DirectX 12 device
+  UINT32 heap_count_ = 0;  // Number of heap slots in use, released heaps
+                           // leave empty slots below it
+  std::vector<ID3D12Heap*> heaps_;  // Heaps, sized to the maximum count
+  std::vector<UINT64> heap_sizes_;  // Size of each heap
+  std::vector<D3D12_HEAP_TYPE> heap_types_;  // Type of each heap
+  std::vector<bool> level_heaps_;            // Holds level allocations
+  std::vector<FreeList> free_lists_;         // Free ranges of each heap
+  std::vector<PageBitmap> page_maps_;  // Free pages of heaps of paged types
+  UINT64 page_size_[DXMA_HEAP_TYPE_COUNT]{};  // 0 if a type is not paged
+  std::unordered_map<UINT64, std::vector<QuickRange>>
+      quick_lists_[DXMA_HEAP_TYPE_COUNT * 3];  // Freed ranges by size, per
+                                               // heap type and lifetime
+  UINT32 quick_list_depth_ = 0;  // Ranges kept per size, 0 if disabled
+  UINT64 quick_list_max_size_ = DXMA_QUICK_LIST_MAX_SIZE;  // Largest range
+  UINT64 quick_bytes_ = 0;       // Size of all ranges in quick lists
+  UINT32 quick_adds_ = 0;        // Ranges added since the last flush
+  UINT32 quick_epoch_ = 0;       // Number of quick list flushes
+  std::unordered_map<UINT64, UINT32>
+      quick_misses_[DXMA_HEAP_TYPE_COUNT * 3];  // Requests per size that found
+                                                // its list empty, for dxmaIdle
+  std::vector<std::vector<PendingRange>> pending_frees_;  // Per heap
+  UINT32 pending_free_limit_ = 0;  // Pending ranges per heap, 0 if disabled
+  UINT64 pending_bytes_ = 0;       // Size of all pending ranges
+  HeapOrder heap_orders_[DXMA_HEAP_TYPE_COUNT * 2];  // Per heap type, for
+                                                    // shared and level heaps
+  UINT64 preferred_heap_size_[DXMA_HEAP_TYPE_COUNT]{};  // Per heap type
+  UINT64 heap_bytes_[DXMA_HEAP_TYPE_COUNT]{};  // Size of all heaps per type
+  DxmaGrowthPolicy growth_policy_ = DXMA_GROWTH_POLICY_FIXED;  // Heap sizing
+  UINT64 min_heap_size_ = DXMA_MIN_HEAP_SIZE;  // First geometric heap size
+  UINT32 request_sizes_[DXMA_HEAP_TYPE_COUNT][64]{};  // Decaying log2
+                                                      // histogram of requests
+  UINT32 request_count_[DXMA_HEAP_TYPE_COUNT]{};  // Requests in the histogram
+  DxmaAllocationStrategy strategy_ =
+      DXMA_ALLOCATION_STRATEGY_DEFAULT;  // Choice of free blocks
+  D3D12_HEAP_FLAGS heap_flags_ = D3D12_HEAP_FLAG_NONE;  // Flags of new heaps
+  PFN_dxmaHeapCallback on_create_heap_ = nullptr;   // Heap creation callback
+  PFN_dxmaHeapCallback on_release_heap_ = nullptr;  // Heap release callback
+  void* callback_user_data_ = nullptr;  // Passed to the heap callbacks
+  DxmaTagStats tag_stats_[DXMA_MAX_TAG_COUNT]{};  // Statistics per tag
+  DxmaHeapTypeStats type_stats_[DXMA_HEAP_TYPE_COUNT]{};  // Per heap type
+  DxmaFrameStats frame_stats_{};  // Activity since dxmaBeginFrame
+  StringArena names_;                             // Interned names
+
+#ifdef DXMA_DEBUG
+  Allocation* allocations_head_ = nullptr;  // First tracked allocation
+  Allocation* allocations_tail_ = nullptr;  // Last tracked allocation
+  UINT32 allocation_count_ = 0;             // Number of tracked allocations
+  UINT64 next_allocation_id_ = 1;           // Id of the next allocation
+  std::unordered_map<CallSiteKey, DxmaCallSiteStats, CallSiteKeyHasher>
+      call_sites_;  // Statistics per call site
+  bool detect_corruption_ = false;  // Whether CPU-visible heaps use margins
+  std::vector<ID3D12Resource*> heap_buffers_;  // Heap-wide buffers
+  std::vector<UINT8*> heap_data_;  // Mapped CPU-visible heaps
+#endif
+
+#ifdef DXMA_TIMING
+  dxma_detail::TimingHistogram
+      timings_[DXMA_TIMING_PHASE_COUNT];  // Latency histogram per phase
+#endif
+
+#ifdef DXMA_TRACE
+  TraceSink* trace_sink_ = nullptr;  // Trace sink, if tracing is active
+#endif
+
+#ifdef DXMA_PROFILING
+  SamplingProfiler* profiler_ = nullptr;  // Sampling profiler, if enabled
+#endif
+
+#ifdef DXMA_JOURNAL
+  Journal* journal_ = nullptr;  // Allocation journal, if open
+#endif
+
+#ifdef DXMA_SHARED_STATS
+  SharedStats* shared_stats_ = nullptr;  // Shared statistics, if open
+#endif
+
+ public:
+  BasicAllocator() : BasicAllocator(DxmaAllocatorDesc{}) {}
+  explicit BasicAllocator(ID3D12Device* device)
+      : BasicAllocator(DxmaAllocatorDesc{device}) {}
+
+  explicit BasicAllocator(const DxmaAllocatorDesc& desc)
+      : device_(desc.device),
+        quick_list_depth_(desc.quick_list_depth),
+        pending_free_limit_(desc.pending_free_limit),
+        growth_policy_(desc.growth_policy),
+        strategy_(desc.strategy),
+        heap_flags_(desc.heap_flags),
+        on_create_heap_(desc.on_create_heap),
+        on_release_heap_(desc.on_release_heap),
+        callback_user_data_(desc.callback_user_data) {
+    UINT32 max_heap_count =
+        desc.max_heap_count ? desc.max_heap_count : DXMA_MAX_HEAP_COUNT;
+    heaps_.resize(max_heap_count, nullptr);
+    heap_sizes_.resize(max_heap_count, 0);
+    heap_types_.resize(max_heap_count, D3D12_HEAP_TYPE_DEFAULT);
+    level_heaps_.resize(max_heap_count, false);
+    free_lists_.resize(max_heap_count);
+    page_maps_.resize(max_heap_count);
+    pending_frees_.resize(max_heap_count);
+    if (desc.min_heap_size) min_heap_size_ = desc.min_heap_size;
+    if (desc.quick_list_max_size) {
+      quick_list_max_size_ = desc.quick_list_max_size;
+    }
+#ifdef DXMA_DEBUG
+    heap_buffers_.resize(max_heap_count, nullptr);
+    heap_data_.resize(max_heap_count, nullptr);
+    if (desc.flags & DXMA_ALLOCATOR_FLAG_CORRUPTION_DETECTION) {
+      detect_corruption_ = true;
+    }
+#endif
+
+    for (UINT32 i = 0; i < DXMA_HEAP_TYPE_COUNT; i++) {
+      UINT64 size = desc.preferred_heap_size[i];
+      preferred_heap_size_[i] = size ? size : DXMA_HEAP_BLOCK_SIZE;
+
+      page_size_[i] = desc.page_size[i];
+      if (page_size_[i] & (page_size_[i] - 1)) {
+        assert(!"Invalid page size passed to dxmaCreateAllocator: not a power "
+                "of two");
+        page_size_[i] = 0;
+      }
+    }
+  }
+
+  ~BasicAllocator() {
+#ifdef DXMA_TRACE
+    delete trace_sink_;
+#endif
+#ifdef DXMA_PROFILING
+    delete profiler_;
+#endif
+#ifdef DXMA_JOURNAL
+    delete journal_;
+#endif
+#ifdef DXMA_SHARED_STATS
+    delete shared_stats_;
+#endif
+
+    // Release all allocated heaps
+    for (UINT32 i = 0; i < heap_count_; i++) {
+      if (!heaps_[i]) continue;
+#ifdef DXMA_DEBUG
+      if (heap_buffers_[i]) {
+        heap_buffers_[i]->Unmap(0, nullptr);
+        heap_buffers_[i]->Release();
+      }
+#endif
+      if (on_release_heap_) {
+        on_release_heap_(heaps_[i], heap_types_[i], heap_sizes_[i], i,
+                         callback_user_data_);
+      }
+      heaps_[i]->Release();
+    }
+    heap_count_ = 0;
+
+    PrintLeakedMemory();
+  }
+
+  // Print memory leaks per call site, largest first, in debug mode
+  void PrintLeakedMemory() {
+#ifdef DXMA_DEBUG
+    std::vector<const DxmaCallSiteStats*> leaks;
+    for (const auto& site : call_sites_) {
+      if (site.second.live_count > 0) leaks.push_back(&site.second);
+    }
+
+    std::sort(leaks.begin(), leaks.end(),
+              [](const DxmaCallSiteStats* a, const DxmaCallSiteStats* b) {
+                return a->live_bytes > b->live_bytes;
+              });
+
+    for (const DxmaCallSiteStats* site : leaks) {
+      std::cerr << "[DXMA] Memory Leaked: " << site->live_bytes
+                << " bytes in " << site->live_count
+                << " allocation(s) allocated at " << site->file << ":"
+                << site->line << "\n";
+    }
+#endif
+  }
+
+  // Get the number of free blocks
+  uint32_t GetFreeBlockCount() const {
+    uint32_t count = 0;
+    for (UINT32 i = 0; i < heap_count_; i++) {
+      count += GetHeapFreeBlockCount(i);
+    }
+    return count;
+  }
+
+  // Whether a heap is tracked as a bitmap of pages instead of a free list
+  bool IsPagedHeap(UINT32 heap_index) const {
+    return page_size_[HeapTypeIndex(heap_types_[heap_index])] != 0;
+  }
+
+  // Get the number of free blocks, or runs of free pages, of a heap
+  UINT32 GetHeapFreeBlockCount(UINT32 heap_index) const {
+    return IsPagedHeap(heap_index) ? page_maps_[heap_index].GetBlockCount()
+                                   : free_lists_[heap_index].GetBlockCount();
+  }
+
+  // Get the free memory of a heap
+  UINT64 GetHeapFreeBytes(UINT32 heap_index) const {
+    return IsPagedHeap(heap_index) ? page_maps_[heap_index].GetFreeBytes()
+                                   : free_lists_[heap_index].GetFreeBytes();
+  }
+
+  // Get the size of the largest free block of a heap
+  UINT64 GetHeapLargestFreeBlock(UINT32 heap_index) const {
+    return IsPagedHeap(heap_index)
+               ? page_maps_[heap_index].GetLargestFreeBlock()
+               : free_lists_[heap_index].GetLargestFreeBlock();
+  }
+
+  // Get the heap type of a heap slot
+  D3D12_HEAP_TYPE GetHeapType(UINT32 heap_index) const {
+    return heap_types_[heap_index];
+  }
+
+  // Get the free lists of all heap slots
+  const FreeList* GetFreeLists() const { return free_lists_.data(); }
+
+  // Get the DirectX 12 device
+  ID3D12Device* GetDevice() const { return device_; }
+
+  // Get the array of allocated heaps
+  ID3D12Heap** GetHeaps() { return heaps_.data(); }
+
+  // Get the number of heap slots, released heaps leave null slots
+  UINT32 GetHeapCount() const { return heap_count_; }
+
+  // Get the maximum number of heaps
+  UINT32 GetMaxHeapCount() const { return static_cast<UINT32>(heaps_.size()); }
+
+  // Get the interned copy of an allocation name
+  const char* InternName(const char* name) { return names_.Intern(name); }
+
+  // Get the statistics of a tag
+  const DxmaTagStats& GetTagStats(UINT32 tag) const { return tag_stats_[tag]; }
+
+  // Account a new allocation to its tag
+  void AddTagAllocation(UINT32 tag, UINT64 size) {
+    DxmaTagStats& stats = tag_stats_[tag];
+    stats.live_count++;
+    stats.live_bytes += size;
+    stats.peak_bytes = std::max(stats.peak_bytes, stats.live_bytes);
+    stats.peak_count = std::max(stats.peak_count, stats.live_count);
+  }
+
+  // Remove a freed allocation from its tag
+  void RemoveTagAllocation(UINT32 tag, UINT64 size) {
+    DxmaTagStats& stats = tag_stats_[tag];
+    stats.live_count--;
+    stats.live_bytes -= size;
+  }
+
+  // Get the statistics of all heap types, indexed by HeapTypeIndex
+  const DxmaHeapTypeStats* GetHeapTypeStats() const { return type_stats_; }
+
+  // Account a new heap to its type and the current frame
+  void RecordCreateHeap(D3D12_HEAP_TYPE type, UINT64 size) {
+    DxmaHeapTypeStats& stats = type_stats_[HeapTypeIndex(type)];
+    stats.heap_count++;
+    stats.heap_bytes += size;
+    stats.peak_heap_count = std::max(stats.peak_heap_count, stats.heap_count);
+    stats.peak_heap_bytes = std::max(stats.peak_heap_bytes, stats.heap_bytes);
+    frame_stats_.create_heap_count++;
+    frame_stats_.created_heap_bytes += size;
+  }
+
+  // Remove a released heap from its type and account it to the current frame
+  void RecordReleaseHeap(D3D12_HEAP_TYPE type, UINT64 size) {
+    DxmaHeapTypeStats& stats = type_stats_[HeapTypeIndex(type)];
+    stats.heap_count--;
+    stats.heap_bytes -= size;
+    frame_stats_.release_heap_count++;
+  }
+
+  // Account a new allocation to its heap type and the current frame
+  void RecordAllocation(D3D12_HEAP_TYPE type, UINT64 size) {
+    DxmaHeapTypeStats& stats = type_stats_[HeapTypeIndex(type)];
+    stats.allocation_count++;
+    stats.allocation_bytes += size;
+    stats.peak_allocation_count =
+        std::max(stats.peak_allocation_count, stats.allocation_count);
+    stats.peak_allocation_bytes =
+        std::max(stats.peak_allocation_bytes, stats.allocation_bytes);
+    frame_stats_.allocation_count++;
+    frame_stats_.allocated_bytes += size;
+  }
+
+  // Remove a freed allocation from its heap type and account it to the
+  // current frame
+  void RecordFree(D3D12_HEAP_TYPE type, UINT64 size) {
+    DxmaHeapTypeStats& stats = type_stats_[HeapTypeIndex(type)];
+    stats.allocation_count--;
+    stats.allocation_bytes -= size;
+    frame_stats_.free_count++;
+    frame_stats_.freed_bytes += size;
+  }
+
+  // Account the new size of a resized allocation to its heap type, and the
+  // size change to the current frame
+  void RecordResize(D3D12_HEAP_TYPE type, UINT64 old_size, UINT64 new_size) {
+    DxmaHeapTypeStats& stats = type_stats_[HeapTypeIndex(type)];
+    stats.allocation_bytes = stats.allocation_bytes - old_size + new_size;
+    stats.peak_allocation_bytes =
+        std::max(stats.peak_allocation_bytes, stats.allocation_bytes);
+    frame_stats_.resize_count++;
+    if (new_size > old_size) {
+      frame_stats_.allocated_bytes += new_size - old_size;
+    } else {
+      frame_stats_.freed_bytes += old_size - new_size;
+    }
+  }
+
+  // Reset the high-water marks of all heap types and tags to current values
+  void ResetPeakStats() {
+    for (DxmaHeapTypeStats& stats : type_stats_) {
+      stats.peak_heap_count = stats.heap_count;
+      stats.peak_heap_bytes = stats.heap_bytes;
+      stats.peak_allocation_count = stats.allocation_count;
+      stats.peak_allocation_bytes = stats.allocation_bytes;
+    }
+    for (DxmaTagStats& stats : tag_stats_) {
+      stats.peak_bytes = stats.live_bytes;
+      stats.peak_count = stats.live_count;
+    }
+  }
+
+  // Get the activity since the frame began
+  const DxmaFrameStats& GetFrameStats() const { return frame_stats_; }
+
+  // Start counting the activity of a new frame
+  void BeginFrame(UINT64 frame_index) {
+    frame_stats_ = DxmaFrameStats{};
+    frame_stats_.frame_index = frame_index;
+  }
+
+#ifdef DXMA_TIMING
+  // Record the duration of an allocator phase
+  void RecordTiming(DxmaTimingPhase phase, UINT64 ns) {
+    timings_[phase].Record(ns);
+  }
+
+  // Get the latency histogram of an allocator phase
+  const TimingHistogram& GetTimingHistogram(DxmaTimingPhase phase) const {
+    return timings_[phase];
+  }
+
+  // Clear the latency histograms of all phases
+  void ResetTimingHistograms() {
+    for (TimingHistogram& histogram : timings_) histogram.Reset();
+  }
+#endif
+
+#ifdef DXMA_TRACE
+  // Get the active trace sink
+  TraceSink* GetTraceSink() const { return trace_sink_; }
+
+  // Set the active trace sink
+  void SetTraceSink(TraceSink* trace_sink) { trace_sink_ = trace_sink; }
+#endif
+
+#ifdef DXMA_PROFILING
+  // Get the sampling profiler, if sampling was enabled
+  SamplingProfiler* GetProfiler() const { return profiler_; }
+
+  // Get the sampling profiler, creating it on first use
+  SamplingProfiler* GetOrCreateProfiler() {
+    if (!profiler_) profiler_ = new SamplingProfiler();
+    return profiler_;
+  }
+#endif
+
+#ifdef DXMA_JOURNAL
+  // Get the allocation journal, if open
+  Journal* GetJournal() const { return journal_; }
+
+  // Set the allocation journal
+  void SetJournal(Journal* journal) { journal_ = journal; }
+#endif
+
+#ifdef DXMA_SHARED_STATS
+  // Get the shared statistics, if open
+  SharedStats* GetSharedStats() const { return shared_stats_; }
+
+  // Set the shared statistics
+  void SetSharedStats(SharedStats* shared_stats) {
+    shared_stats_ = shared_stats;
+  }
+#endif
+
+  // Append an allocation to the tracking list (debug mode only)
+  void AddAllocation(Allocation* allocation) {
+#ifdef DXMA_DEBUG
+    allocation->SetPrev(allocations_tail_);
+    allocation->SetNext(nullptr);
+    allocation->SetTracked(true);
+    allocation->SetId(next_allocation_id_++);
+
+    if (allocations_tail_) {
+      allocations_tail_->SetNext(allocation);
+    } else {
+      allocations_head_ = allocation;
+    }
+    allocations_tail_ = allocation;
+    allocation_count_++;
+
+    // Account the allocation to its call site
+    DxmaCallSiteStats& site =
+        call_sites_[CallSiteKey{allocation->GetFile(), allocation->GetLine()}];
+    site.file = allocation->GetFile();
+    site.line = allocation->GetLine();
+    site.live_count++;
+    site.live_bytes += allocation->GetSize();
+    site.peak_bytes = std::max(site.peak_bytes, site.live_bytes);
+    site.total_count++;
+    allocation->SetCallSite(&site);
+#endif
+  }
+
+  // Unlink an allocation from the tracking list (debug mode only)
+  uint32_t RemoveAllocation(Allocation* allocation) {
+#ifdef DXMA_DEBUG
+    if (!allocation->IsTracked()) return 0;
+
+    Allocation* prev = allocation->GetPrev();
+    Allocation* next = allocation->GetNext();
+    if (prev) {
+      prev->SetNext(next);
+    } else {
+      allocations_head_ = next;
+    }
+    if (next) {
+      next->SetPrev(prev);
+    } else {
+      allocations_tail_ = prev;
+    }
+
+    allocation->SetPrev(nullptr);
+    allocation->SetNext(nullptr);
+    allocation->SetTracked(false);
+    allocation_count_--;
+
+    DxmaCallSiteStats* site = allocation->GetCallSite();
+    site->live_count--;
+    site->live_bytes -= allocation->GetSize();
+    return 1;
+#else
+    return 0;
+#endif
+  }
+
+#ifdef DXMA_DEBUG
+  // Get the number of tracked allocations (debug mode only)
+  UINT32 GetAllocationCount() const { return allocation_count_; }
+
+  // Call a function for every tracked allocation in allocation order, the
+  // function may free the allocation it is called with (debug mode only)
+  void EnumerateAllocations(void (*callback)(Allocation*, void*),
+                            void* user_data) const {
+    Allocation* alloc = allocations_head_;
+    while (alloc) {
+      Allocation* next = alloc->GetNext();
+      callback(alloc, user_data);
+      alloc = next;
+    }
+  }
+
+  // Copy all tracked allocations into a snapshot, the tracking list is in
+  // allocation order, so the entries are sorted by id (debug mode only)
+  void TakeSnapshot(DxmaSnapshot* snapshot) const {
+    snapshot->next_id = next_allocation_id_;
+    snapshot->entry_count = allocation_count_;
+    snapshot->entries = new DxmaSnapshotEntry[allocation_count_];
+
+    DxmaSnapshotEntry* entry = snapshot->entries;
+    for (Allocation* alloc = allocations_head_; alloc;
+         alloc = alloc->GetNext(), entry++) {
+      entry->id = alloc->GetId();
+      entry->size = alloc->GetSize();
+      entry->heap_index = alloc->GetHeapIndex();
+      entry->tag = alloc->GetTag();
+      entry->file = alloc->GetFile();
+      entry->line = alloc->GetLine();
+    }
+  }
+
+  // Enable margins around allocations in CPU-visible heaps, only possible
+  // before the first heap is created (debug mode only)
+  bool EnableCorruptionDetection() {
+    if (heap_count_ > 0) return false;
+    detect_corruption_ = true;
+    return true;
+  }
+
+  // Get the size of the margin placed before an allocation of a heap type,
+  // rounded up to keep the alignment, or 0 if no margins are used
+  UINT64 GetFrontMargin(D3D12_HEAP_TYPE type, UINT64 alignment) const {
+    if (!detect_corruption_ || !IsCpuVisible(type)) return 0;
+    if (alignment <= 1) return DXMA_DEBUG_MARGIN;
+    return (DXMA_DEBUG_MARGIN + alignment - 1) / alignment * alignment;
+  }
+
+  // Map a new CPU-visible heap through a buffer spanning the whole heap and
+  // fill it with the freed pattern (debug mode only)
+  void MapHeap(UINT32 heap_index, D3D12_HEAP_TYPE type, UINT64 heap_size) {
+    if (!detect_corruption_ || !IsCpuVisible(type)) return;
+
+    D3D12_RESOURCE_DESC buffer_desc{};
+    buffer_desc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+    buffer_desc.Width = heap_size;
+    buffer_desc.Height = 1;
+    buffer_desc.DepthOrArraySize = 1;
+    buffer_desc.MipLevels = 1;
+    buffer_desc.Format = DXGI_FORMAT_UNKNOWN;
+    buffer_desc.SampleDesc.Count = 1;
+    buffer_desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+
+    D3D12_RESOURCE_STATES state = type == D3D12_HEAP_TYPE_UPLOAD
+                                      ? D3D12_RESOURCE_STATE_GENERIC_READ
+                                      : D3D12_RESOURCE_STATE_COPY_DEST;
+
+    ID3D12Resource* buffer = nullptr;
+    if (FAILED(device_->CreatePlacedResource(heaps_[heap_index], 0,
+                                             &buffer_desc, state, nullptr,
+                                             IID_PPV_ARGS(&buffer)))) {
+      return;
+    }
+
+    void* data = nullptr;
+    if (FAILED(buffer->Map(0, nullptr, &data))) {
+      buffer->Release();
+      return;
+    }
+
+    heap_buffers_[heap_index] = buffer;
+    heap_data_[heap_index] = static_cast<UINT8*>(data);
+    memset(data, kFreedPattern, heap_size);
+  }
+
+  // Fill the margins of a new allocation (debug mode only)
+  void WriteMargins(Allocation* allocation) {
+    UINT8* data = heap_data_[allocation->GetHeapIndex()];
+    if (!data || allocation->GetMargin() == 0) return;
+
+    memset(data + allocation->GetBlockOffset(), kMarginPattern,
+           allocation->GetMargin());
+    memset(data + allocation->GetOffset() + allocation->GetSize(),
+           kMarginPattern, DXMA_DEBUG_MARGIN);
+  }
+
+  // Check the margins of an allocation and print where it was allocated if
+  // they were overwritten (debug mode only)
+  bool ValidateMargins(const Allocation* allocation) const {
+    const UINT8* data = heap_data_[allocation->GetHeapIndex()];
+    if (!data || allocation->GetMargin() == 0) return true;
+
+    UINT64 end = allocation->GetOffset() + allocation->GetSize();
+    bool before = IsFilled(data + allocation->GetBlockOffset(),
+                           allocation->GetMargin(), kMarginPattern);
+    bool after = IsFilled(data + end, DXMA_DEBUG_MARGIN, kMarginPattern);
+    if (before && after) return true;
+
+    std::cerr << "[DXMA] Memory Corrupted: " << (before ? "after" : "before")
+              << " " << allocation->GetSize() << " bytes allocated at "
+              << allocation->GetFile() << ":" << allocation->GetLine() << "\n";
+    return false;
+  }
+
+  // Fill the reserved range of a freed allocation (debug mode only)
+  void PoisonAllocation(const Allocation* allocation) {
+    UINT8* data = heap_data_[allocation->GetHeapIndex()];
+    if (!data) return;
+
+    memset(data + allocation->GetBlockOffset(), kFreedPattern,
+           allocation->GetBlockSize());
+  }
+
+  // Check the margins of all allocations and the contents of all free blocks
+  // in mapped heaps, returns the number of corrupted ranges (debug mode only)
+  UINT32 CheckCorruption() const {
+    UINT32 corrupted = 0;
+    for (Allocation* alloc = allocations_head_; alloc;
+         alloc = alloc->GetNext()) {
+      if (!ValidateMargins(alloc)) corrupted++;
+    }
+
+    for (UINT32 i = 0; i < heap_count_; i++) {
+      const UINT8* data = heap_data_[i];
+      if (!data) continue;
+
+      if (IsPagedHeap(i)) {
+        page_maps_[i].ForEachFreeRange([&](UINT64 offset, UINT64 size) {
+          if (!IsFilled(data + offset, size, kFreedPattern)) {
+            std::cerr << "[DXMA] Memory Corrupted: " << size
+                      << " bytes of freed memory written at offset " << offset
+                      << " of heap " << i << "\n";
+            corrupted++;
+          }
+        });
+        continue;
+      }
+
+      for (FreeBlock* block = free_lists_[i].GetHead(); block;
+           block = block->GetNext()) {
+        if (!IsFilled(data + block->GetOffset(), block->GetSize(),
+                      kFreedPattern)) {
+          std::cerr << "[DXMA] Memory Corrupted: " << block->GetSize()
+                    << " bytes of freed memory written at offset "
+                    << block->GetOffset() << " of heap " << i << "\n";
+          corrupted++;
+        }
+      }
+    }
+    return corrupted;
+  }
+
+  // Call a function for every call site that allocated memory (debug mode
+  // only)
+  void EnumerateCallSites(void (*callback)(const DxmaCallSiteStats*, void*),
+                          void* user_data) const {
+    for (const auto& site : call_sites_) {
+      callback(&site.second, user_data);
+    }
+  }
+#endif
+
+  // Allocate memory, creating a new heap if no free block fits
+  void Allocate(const DxmaAllocationInfo& alloc_info, Allocation** allocation
+#ifdef DXMA_DEBUG
+                ,
+                const char* file, int line
+#endif
+  ) {
+    UINT64 size = alloc_info.size;
+    D3D12_HEAP_TYPE type = alloc_info.type;
+    UINT64 alignment = alloc_info.alignment;
+    DxmaLifetime lifetime = alloc_info.lifetime;
+    bool top_down = lifetime == DXMA_LIFETIME_TRANSIENT;
+
+    if (size == 0) return;
+    std::lock_guard<LockPolicy> lock(lock_);
+    size = alignment == 0 ? size : (size + alignment - 1) & ~(alignment - 1);
+
+    // Size of the reserved range, including corruption detection margins
+    UINT64 block_size = size;
+#ifdef DXMA_DEBUG
+    UINT64 margin = GetFrontMargin(type, alignment);
+    if (margin > 0) block_size += margin + DXMA_DEBUG_MARGIN;
+#endif
+
+    // Paged heap types reserve whole pages
+    UINT64 page_size = page_size_[HeapTypeIndex(type)];
+    if (page_size) block_size = AlignUp(block_size, page_size);
+
+    if (growth_policy_ == DXMA_GROWTH_POLICY_GEOMETRIC) {
+      RecordRequestSize(type, block_size);
+    }
+
+#ifdef DXMA_TRACE
+    TraceAllocationScope trace_scope(trace_sink_, alloc_info, allocation);
+#endif
+
+    DXMA_TIMING_START(timer);
+
+    UINT32 heap_index = 0;
+    UINT64 offset = 0;
+    bool found = quick_list_depth_ > 0 &&
+                 PopQuickRange(type, lifetime, block_size, alignment,
+                               &heap_index, &offset);
+
+    // If no block fits, coalesce the quick lists and pending frees of the
+    // heaps searched and search again, so that they do not cause a new heap
+    bool level = lifetime == DXMA_LIFETIME_LEVEL;
+    FreeBlock* ptr = nullptr;
+    for (int attempt = 0; !found && attempt < 2; attempt++) {
+      if (attempt > 0) {
+        if (quick_bytes_ + pending_bytes_ == 0) break;
+        ReturnHeapOrderRanges(type, level);
+      }
+
+      if (page_size) {
+        found = AllocatePages(type, lifetime, block_size, alignment,
+                              &heap_index, &offset);
+      } else {
+        ptr = FindFreeBlock(type, lifetime, block_size, alignment,
+                            &heap_index);
+        found = ptr != nullptr;
+      }
+    }
+    DXMA_TIMING_LAP(this, DXMA_TIMING_PHASE_ALLOCATE_SEARCH, timer);
+
+    if (ptr) {
+      offset = free_lists_[heap_index].Split(ptr, block_size, alignment,
+                                             top_down);
+    }
+
+    if (found) {
+      UpdateHeapOrder(heap_index);
+      DXMA_TIMING_LAP(this, DXMA_TIMING_PHASE_ALLOCATE_SPLIT, timer);
+
+      *allocation = CreateAllocation(alloc_info, size, offset, heap_index,
+                                     heaps_[heap_index]
+#ifdef DXMA_DEBUG
+                                     ,
+                                     margin, file, line
+#endif
+      );
+      DXMA_TIMING_LAP(this, DXMA_TIMING_PHASE_ALLOCATE_METADATA, timer);
+      return;
+    }
+
+    // Out of memory: allocate a new heap in the first free slot
+    if (FindHeapSlot() >= heaps_.size()) {
+      assert(!"dxmaAllocate failed: maximum heap count reached");
+      return;
+    }
+
+    UINT64 heap_block_size = GetNextHeapSize(type, block_size);
+    if (page_size) heap_block_size = AlignUp(heap_block_size, page_size);
+
+    heap_index =
+        CreateHeap(type, heap_block_size, lifetime == DXMA_LIFETIME_LEVEL);
+    if (heap_index >= heaps_.size()) return;
+
+    // Reserve the front of the new heap, or its end for transient allocations
+    if (page_size) {
+      page_maps_[heap_index].Allocate(block_size, alignment, top_down,
+                                      &offset);
+    } else {
+      FreeList& free_list = free_lists_[heap_index];
+      offset = free_list.Split(free_list.GetHead(), block_size, alignment,
+                               top_down);
+    }
+    UpdateHeapOrder(heap_index);
+    DXMA_TIMING_LAP(this, DXMA_TIMING_PHASE_CREATE_HEAP, timer);
+
+    *allocation = CreateAllocation(alloc_info, size, offset, heap_index,
+                                   heaps_[heap_index]
+#ifdef DXMA_DEBUG
+                                   ,
+                                   margin, file, line
+#endif
+    );
+    DXMA_TIMING_LAP(this, DXMA_TIMING_PHASE_ALLOCATE_METADATA, timer);
+  }
+
+  // Return an allocation to the free block list, merging adjacent blocks
+  void Free(Allocation* allocation, ID3D12Resource* resource) {
+    if (allocation->GetSize() == 0 || allocation->GetHeap() == nullptr) {
+      assert(
+          !"Invalid allocation passed to dxmaFree: size is 0 or heap is null");
+      return;
+    }
+
+    std::lock_guard<LockPolicy> lock(lock_);
+
+#ifdef DXMA_DEBUG
+    if constexpr (TrackingPolicy::kEnabled) {
+      if (RemoveAllocation(allocation) != 1) {
+        assert(!"Invalid allocation passed to dxmaFree: allocation was not "
+                "tracked");
+        return;
+      }
+    }
+#endif
+
+#ifdef DXMA_PROFILING
+    if (profiler_) profiler_->OnFree(allocation);
+#endif
+
+    if constexpr (StatsPolicy::kEnabled) {
+      RemoveTagAllocation(allocation->GetTag(), allocation->GetSize());
+      RecordFree(allocation->GetHeapType(), allocation->GetSize());
+    }
+
+#ifdef DXMA_JOURNAL
+    if (journal_) journal_->OnFree(allocation);
+#endif
+
+#ifdef DXMA_DEBUG
+    if (!ValidateMargins(allocation)) {
+      assert(!"Corrupted allocation passed to dxmaFree: margins were written");
+    }
+    PoisonAllocation(allocation);
+#endif
+
+    UINT64 block_offset = allocation->GetBlockOffset();
+    UINT64 block_size = allocation->GetBlockSize();
+    UINT32 heap_index = allocation->GetHeapIndex();
+    DxmaLifetime lifetime = allocation->GetLifetime();
+
+    // Release the resource if it's not managed by the allocation
+    if (resource && !allocation->GetResource()) {
+      resource->Release();
+    }
+
+    delete allocation;
+    allocation = nullptr;
+
+    // Keep the range for an allocation of the same size if it is small
+    if (PushQuickRange(heap_index, block_offset, block_size, lifetime)) {
+      return;
+    }
+    ReturnRange(heap_index, block_offset, block_size);
+  }
+
+  // Grow an allocation into the free range that follows it in its heap, or
+  // shrink it by returning its tail, returns false if it must be moved
+  bool Resize(Allocation* allocation, UINT64 new_size) {
+    if (allocation->GetSize() == 0 || allocation->GetHeap() == nullptr ||
+        new_size == 0) {
+      assert(!"Invalid arguments passed to dxmaResize: size is 0 or heap is "
+              "null");
+      return false;
+    }
+
+    std::lock_guard<LockPolicy> lock(lock_);
+    new_size = AlignUp(new_size, allocation->GetAlignment());
+
+#ifdef DXMA_DEBUG
+    if (!ValidateMargins(allocation)) {
+      assert(
+          !"Corrupted allocation passed to dxmaResize: margins were written");
+    }
+#endif
+
+    D3D12_HEAP_TYPE type = allocation->GetHeapType();
+    UINT32 heap_index = allocation->GetHeapIndex();
+    UINT64 old_size = allocation->GetSize();
+    UINT64 block_offset = allocation->GetBlockOffset();
+    UINT64 block_size = allocation->GetBlockSize();
+    UINT64 new_block_size = block_size - old_size + new_size;
+
+    // Paged heaps reserve whole pages, so sizes within a page need no change
+    UINT64 page_size = page_size_[HeapTypeIndex(type)];
+    block_size = AlignUp(block_size, page_size);
+    new_block_size = AlignUp(new_block_size, page_size);
+
+    if (new_block_size > block_size) {
+      // The range after the allocation may still be held in quick lists or
+      // waiting to be merged
+      UINT64 end = block_offset + block_size;
+      UINT64 grow_size = new_block_size - block_size;
+      if (quick_bytes_ > 0) {
+        ReturnQuickRangesIn(heap_index, end, end + grow_size);
+      }
+      if (page_size) {
+        if (!page_maps_[heap_index].AllocateAt(end, grow_size)) return false;
+      } else {
+        MergePendingFrees(heap_index);
+        if (!free_lists_[heap_index].AllocateAt(end, grow_size)) return false;
+      }
+      UpdateHeapOrder(heap_index);
+    } else if (new_block_size < block_size) {
+      UINT64 tail = block_offset + new_block_size;
+#ifdef DXMA_DEBUG
+      if (heap_data_[heap_index]) {
+        memset(heap_data_[heap_index] + tail, kFreedPattern,
+               block_size - new_block_size);
+      }
+#endif
+      ReturnRange(heap_index, tail, block_size - new_block_size);
+    }
+
+    allocation->SetSize(new_size);
+#ifdef DXMA_PROFILING
+    if (profiler_) profiler_->OnResize(allocation, old_size);
+#endif
+    if constexpr (StatsPolicy::kEnabled) {
+      RemoveTagAllocation(allocation->GetTag(), old_size);
+      AddTagAllocation(allocation->GetTag(), new_size);
+      RecordResize(type, old_size, new_size);
+    }
+#ifdef DXMA_DEBUG
+    if (allocation->IsTracked()) {
+      DxmaCallSiteStats* site = allocation->GetCallSite();
+      site->live_bytes = site->live_bytes - old_size + new_size;
+      site->peak_bytes = std::max(site->peak_bytes, site->live_bytes);
+    }
+    WriteMargins(allocation);
+#endif
+#ifdef DXMA_JOURNAL
+    if (journal_) journal_->OnResize(allocation, old_size);
+#endif
+    return true;
+  }
+
+  // Return all ranges in quick lists to their heaps, returns their number
+  UINT32 FlushQuickLists() {
+    std::lock_guard<LockPolicy> lock(lock_);
+    return ReturnQuickRanges(true);
+  }
+
+  // Get the size of all ranges in quick lists
+  UINT64 GetQuickListBytes() const { return quick_bytes_; }
+
+  // Merge all pending frees into their free lists, returns their number
+  UINT32 Coalesce() {
+    std::lock_guard<LockPolicy> lock(lock_);
+    return MergePendingFrees();
+  }
+
+  // Get the size of all freed ranges waiting to be merged
+  UINT64 GetPendingFreeBytes() const { return pending_bytes_; }
+
+  // Do deferred work in slices until budget_us microseconds have passed,
+  // returns true if all of it was done. The lock is held for the whole
+  // budget, so it should be spent in frame slack
+  bool Idle(UINT64 budget_us) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::microseconds(budget_us);
+    auto expired = [&deadline] {
+      return std::chrono::steady_clock::now() >= deadline;
+    };
+    std::lock_guard<LockPolicy> lock(lock_);
+
+    // Return the quick list ranges that were not reused since the last pass,
+    // then merge the pending frees, one heap per slice
+    if (quick_bytes_ > 0) {
+      if (expired()) return false;
+      ReturnQuickRanges(false);
+    }
+    for (UINT32 i = 0; pending_bytes_ > 0 && i < heap_count_; i++) {
+      if (pending_frees_[i].empty()) continue;
+      if (expired()) return false;
+      MergePendingFrees(i);
+    }
+
+    // Pre-split ranges of the sizes that missed the quick lists, one size per
+    // slice
+    for (UINT32 i = 0; i < DXMA_HEAP_TYPE_COUNT * 3; i++) {
+      auto& misses = quick_misses_[i];
+      while (!misses.empty()) {
+        if (expired()) return false;
+        PreSplitQuickRanges(i, misses.begin()->first, misses.begin()->second);
+        misses.erase(misses.begin());
+      }
+    }
+
+    // Keep the heaps of each type at its peak allocation size, the demand
+    // predicted until dxmaResetPeakStats: release the empty heaps above it
+    // and create a heap when the type has less
+    if constexpr (StatsPolicy::kEnabled) {
+      for (UINT32 i = 0; i < heap_count_; i++) {
+        if (!heaps_[i] || GetHeapFreeBytes(i) != heap_sizes_[i]) continue;
+        UINT32 index = HeapTypeIndex(heap_types_[i]);
+        if (heap_bytes_[index] - heap_sizes_[i] <
+            type_stats_[index].peak_allocation_bytes) {
+          continue;
+        }
+        if (expired()) return false;
+        free_lists_[i].Clear();
+        page_maps_[i].Clear();
+        ReleaseHeap(i, heap_types_[i]);
+      }
+      while (heap_count_ > 0 && !heaps_[heap_count_ - 1]) heap_count_--;
+
+      // Predicted demand is covered with heaps of the regular size, one per
+      // slice, not with a single heap sized for the whole deficit
+      for (UINT32 index = 1; index < DXMA_HEAP_TYPE_COUNT; index++) {
+        D3D12_HEAP_TYPE type = static_cast<D3D12_HEAP_TYPE>(index);
+        UINT64 peak_bytes = type_stats_[index].peak_allocation_bytes;
+        while (heap_bytes_[index] < peak_bytes) {
+          if (FindHeapSlot() >= heaps_.size()) return false;
+          if (expired()) return false;
+
+          UINT64 heap_size = GetGrowthHeapSize(type);
+          heap_size = AlignUp(heap_size, page_size_[index]);
+          if (CreateHeap(type, heap_size, false) >= heaps_.size()) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // Release empty heaps, smallest first, until releasing the next one would
+  // exceed max_release_bytes, returns the number of released heaps
+  UINT32 Trim(UINT64 max_release_bytes) {
+    std::lock_guard<LockPolicy> lock(lock_);
+    ReturnQuickRanges(true);
+    MergePendingFrees();
+
+    // A heap is empty when a single free block spans all of it
+    std::vector<std::pair<UINT64, UINT32>> empty_heaps;
+    for (UINT32 i = 0; i < heap_count_; i++) {
+      if (heaps_[i] && GetHeapFreeBytes(i) == heap_sizes_[i]) {
+        empty_heaps.emplace_back(heap_sizes_[i], i);
+      }
+    }
+    std::sort(empty_heaps.begin(), empty_heaps.end());
+
+    UINT32 release_count = 0;
+    UINT64 release_bytes = 0;
+    for (const auto& empty_heap : empty_heaps) {
+      if (empty_heap.first > max_release_bytes - release_bytes) break;
+      free_lists_[empty_heap.second].Clear();
+      page_maps_[empty_heap.second].Clear();
+      ReleaseHeap(empty_heap.second, heap_types_[empty_heap.second]);
+      release_bytes += empty_heap.first;
+      release_count++;
+    }
+
+    while (heap_count_ > 0 && !heaps_[heap_count_ - 1]) heap_count_--;
+    return release_count;
+  }
+
+ private:
+  // Create a heap of a type in the first free slot with all of it free,
+  // returns the slot or the maximum heap count on failure
+  UINT32 CreateHeap(D3D12_HEAP_TYPE type, UINT64 heap_size, bool level) {
+    UINT32 heap_index = FindHeapSlot();
+    if (heap_index >= heaps_.size()) return heap_index;
+
+    assert(device_);
+
+    D3D12_HEAP_DESC heap_desc{};
+    heap_desc.SizeInBytes = heap_size;
+    heap_desc.Flags = heap_flags_;
+    heap_desc.Properties.Type = type;
+    heap_desc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+
+#ifdef DXMA_TRACE
+    UINT64 create_heap_start_ns = TimingNow();
+#endif
+
+    ID3D12Heap* new_heap = nullptr;
+    HRESULT hr = device_->CreateHeap(&heap_desc, IID_PPV_ARGS(&new_heap));
+    assert(SUCCEEDED(hr));
+
+    if (FAILED(hr)) return static_cast<UINT32>(heaps_.size());
+
+    heaps_[heap_index] = new_heap;
+    heap_sizes_[heap_index] = heap_size;
+    heap_types_[heap_index] = type;
+    level_heaps_[heap_index] = level;
+    heap_bytes_[HeapTypeIndex(type)] += heap_size;
+    if (on_create_heap_) {
+      on_create_heap_(new_heap, type, heap_size, heap_index,
+                      callback_user_data_);
+    }
+    if constexpr (StatsPolicy::kEnabled) {
+      RecordCreateHeap(type, heap_size);
+    }
+#ifdef DXMA_DEBUG
+    MapHeap(heap_index, type, heap_size);
+#endif
+#ifdef DXMA_JOURNAL
+    if (journal_) journal_->OnCreateHeap(heap_index, type, heap_size);
+#endif
+
+#ifdef DXMA_TRACE
+    if (trace_sink_) {
+      TraceEvent event;
+      event.name = "CreateHeap";
+      event.start_ns = create_heap_start_ns;
+      event.duration_ns = TimingNow() - create_heap_start_ns;
+      event.size = heap_size;
+      event.heap_type = type;
+      event.heap_index = heap_index;
+      trace_sink_->Record(event);
+    }
+#endif
+
+    UINT64 page_size = page_size_[HeapTypeIndex(type)];
+    if (page_size) {
+      page_maps_[heap_index].Reset(heap_size, page_size);
+    } else {
+      free_lists_[heap_index].Reset(heap_size, type, heap_index, new_heap);
+    }
+    heap_count_ = std::max(heap_count_, heap_index + 1);
+    GetHeapOrder(heap_index)
+        .Add(heap_index, heap_size, GetHeapFreeBytes(heap_index),
+             GetHeapLargestFreeBlock(heap_index));
+    return heap_index;
+  }
+
+  // Get the first free heap slot, or the maximum heap count if all are used
+  UINT32 FindHeapSlot() const {
+    UINT32 heap_index = 0;
+    while (heap_index < heap_count_ && heaps_[heap_index]) heap_index++;
+    return heap_index;
+  }
+
+  // Release an empty heap and free its slot
+  void ReleaseHeap(UINT32 heap_index, D3D12_HEAP_TYPE type) {
+    ID3D12Heap* heap = heaps_[heap_index];
+    UINT64 heap_size = heap_sizes_[heap_index];
+
+    if (on_release_heap_) {
+      on_release_heap_(heap, type, heap_size, heap_index, callback_user_data_);
+    }
+#ifdef DXMA_DEBUG
+    if (heap_buffers_[heap_index]) {
+      heap_buffers_[heap_index]->Unmap(0, nullptr);
+      heap_buffers_[heap_index]->Release();
+      heap_buffers_[heap_index] = nullptr;
+      heap_data_[heap_index] = nullptr;
+    }
+#endif
+    heap->Release();
+    heaps_[heap_index] = nullptr;
+    heap_sizes_[heap_index] = 0;
+    heap_bytes_[HeapTypeIndex(type)] -= heap_size;
+    GetHeapOrder(heap_index).Remove(heap_index);
+
+    if constexpr (StatsPolicy::kEnabled) RecordReleaseHeap(type, heap_size);
+#ifdef DXMA_JOURNAL
+    if (journal_) journal_->OnReleaseHeap(heap_index, type, heap_size);
+#endif
+#ifdef DXMA_TRACE
+    if (trace_sink_) {
+      TraceEvent event;
+      event.name = "ReleaseHeap";
+      event.start_ns = TimingNow();
+      event.size = heap_size;
+      event.heap_type = type;
+      event.heap_index = heap_index;
+      trace_sink_->Record(event);
+    }
+#endif
+  }
+
+  // Get the heap order a heap belongs to
+  HeapOrder& GetHeapOrder(UINT32 heap_index) {
+    UINT32 index = HeapTypeIndex(heap_types_[heap_index]);
+    return heap_orders_[index * 2 + level_heaps_[heap_index]];
+  }
+
+  // Move a heap to its place in its order after its free memory changed
+  void UpdateHeapOrder(UINT32 heap_index) {
+    GetHeapOrder(heap_index)
+        .Update(heap_index, GetHeapFreeBytes(heap_index),
+                GetHeapLargestFreeBlock(heap_index));
+  }
+
+  // Reserve pages in the fullest heap of a paged type that has a long enough
+  // run of free pages, heap_index and offset receive the range
+  bool AllocatePages(D3D12_HEAP_TYPE type, DxmaLifetime lifetime, UINT64 size,
+                     UINT64 alignment, UINT32* heap_index, UINT64* offset) {
+    bool level = lifetime == DXMA_LIFETIME_LEVEL;
+    bool top_down = lifetime == DXMA_LIFETIME_TRANSIENT;
+    const HeapOrder& order = heap_orders_[HeapTypeIndex(type) * 2 + level];
+    for (size_t pos = order.FindFirst(size, 0); pos < order.GetCount();
+         pos = order.FindFirst(size, pos + 1)) {
+      UINT32 i = order.GetHeapIndex(pos);
+      if (page_maps_[i].Allocate(size, alignment, top_down, offset)) {
+        *heap_index = i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Return a freed range to the free list or page bitmap of its heap
+  void ReturnRange(UINT32 heap_index, UINT64 offset, UINT64 size) {
+    DXMA_TIMING_START(timer);
+
+    if (IsPagedHeap(heap_index)) {
+      page_maps_[heap_index].Free(offset, size);
+      UpdateHeapOrder(heap_index);
+      DXMA_TIMING_LAP(this, DXMA_TIMING_PHASE_FREE_MERGE, timer);
+      return;
+    }
+
+    // Collect the range and merge the heap's ranges in a batch later
+    if (pending_free_limit_) {
+      std::vector<PendingRange>& pending = pending_frees_[heap_index];
+      pending.push_back(PendingRange{offset, size});
+      pending_bytes_ += size;
+      if (pending.size() >= pending_free_limit_) MergePendingFrees(heap_index);
+      return;
+    }
+
+    // Find the correct position to insert the range
+    FreeList& free_list = free_lists_[heap_index];
+    FreeBlock* prev = free_list.FindPrevious(offset);
+    DXMA_TIMING_LAP(this, DXMA_TIMING_PHASE_FREE_SEARCH, timer);
+
+    free_list.Insert(prev, offset, size, heap_types_[heap_index], heap_index,
+                     heaps_[heap_index]);
+    UpdateHeapOrder(heap_index);
+    DXMA_TIMING_LAP(this, DXMA_TIMING_PHASE_FREE_MERGE, timer);
+  }
+
+  // Merge the pending frees of a heap into its free list in one sorted sweep,
+  // returns their number
+  UINT32 MergePendingFrees(UINT32 heap_index) {
+    std::vector<PendingRange>& pending = pending_frees_[heap_index];
+    if (pending.empty()) return 0;
+
+    DXMA_TIMING_START(timer);
+    for (const PendingRange& range : pending) pending_bytes_ -= range.size;
+    free_lists_[heap_index].InsertBatch(pending, heap_types_[heap_index],
+                                        heap_index, heaps_[heap_index]);
+    UpdateHeapOrder(heap_index);
+    DXMA_TIMING_LAP(this, DXMA_TIMING_PHASE_FREE_MERGE, timer);
+
+    UINT32 count = static_cast<UINT32>(pending.size());
+    pending.clear();
+    return count;
+  }
+
+  // Return the quick list ranges and merge the pending frees of the shared
+  // or level heaps of one type
+  void ReturnHeapOrderRanges(D3D12_HEAP_TYPE type, bool level) {
+    if (level) {
+      ReturnQuickList(quick_lists_[QuickListIndex(type, DXMA_LIFETIME_LEVEL)],
+                      true);
+    } else {
+      ReturnQuickList(
+          quick_lists_[QuickListIndex(type, DXMA_LIFETIME_PERMANENT)], true);
+      ReturnQuickList(
+          quick_lists_[QuickListIndex(type, DXMA_LIFETIME_TRANSIENT)], true);
+    }
+
+    for (UINT32 i = 0; pending_bytes_ > 0 && i < heap_count_; i++) {
+      if (heaps_[i] && heap_types_[i] == type && level_heaps_[i] == level) {
+        MergePendingFrees(i);
+      }
+    }
+  }
+
+  // Merge the pending frees of all heaps, returns their number
+  UINT32 MergePendingFrees() {
+    UINT32 count = 0;
+    for (UINT32 i = 0; pending_bytes_ > 0 && i < heap_count_; i++) {
+      count += MergePendingFrees(i);
+    }
+    return count;
+  }
+
+  // Get the quick lists of a heap type and lifetime, so that ranges are only
+  // reused with the placement they were made with
+  static UINT32 QuickListIndex(D3D12_HEAP_TYPE type, DxmaLifetime lifetime) {
+    return HeapTypeIndex(type) * 3 + lifetime;
+  }
+
+  // Keep a freed range in the quick list of its size, returns false if quick
+  // lists are disabled, the range is too large or the list is full
+  bool PushQuickRange(UINT32 heap_index, UINT64 offset, UINT64 size,
+                      DxmaLifetime lifetime) {
+    if (quick_list_depth_ == 0) return false;
+
+    // Paged heaps are allocated in whole pages
+    UINT64 page_size = page_size_[HeapTypeIndex(heap_types_[heap_index])];
+    if (page_size) size = AlignUp(size, page_size);
+    if (size > quick_list_max_size_) return false;
+
+    UINT32 list_index = QuickListIndex(heap_types_[heap_index], lifetime);
+    std::vector<QuickRange>& ranges = quick_lists_[list_index][size];
+    if (ranges.size() >= quick_list_depth_) return false;
+
+    ranges.push_back(QuickRange{heap_index, offset, quick_epoch_});
+    quick_bytes_ += size;
+
+    // Regularly coalesce the ranges of sizes that are no longer reused
+    if (++quick_adds_ >= DXMA_QUICK_LIST_FLUSH_INTERVAL) {
+      ReturnQuickRanges(false);
+    }
+    return true;
+  }
+
+  // Take the most recently freed range of exactly size bytes that has the
+  // alignment from the quick lists, counting the sizes whose ranges ran out
+  bool PopQuickRange(D3D12_HEAP_TYPE type, DxmaLifetime lifetime, UINT64 size,
+                     UINT64 alignment, UINT32* heap_index, UINT64* offset) {
+    if (size > quick_list_max_size_) return false;
+
+    // Sizes that were never freed are not counted, they may never repeat
+    UINT32 list_index = QuickListIndex(type, lifetime);
+    auto it = quick_lists_[list_index].find(size);
+    if (it == quick_lists_[list_index].end()) return false;
+
+    std::vector<QuickRange>& ranges = it->second;
+    for (size_t i = ranges.size(); i > 0; i--) {
+      const QuickRange& range = ranges[i - 1];
+      if (AlignUp(range.offset, alignment) != range.offset) continue;
+
+      *heap_index = range.heap_index;
+      *offset = range.offset;
+      ranges.erase(ranges.begin() + (i - 1));
+      quick_bytes_ -= size;
+      return true;
+    }
+    RecordQuickMiss(list_index, size);
+    return false;
+  }
+
+  // Count a request that found the quick list of its size empty, so dxmaIdle
+  // can pre-split ranges of its size
+  void RecordQuickMiss(UINT32 list_index, UINT64 size) {
+    auto& misses = quick_misses_[list_index];
+    auto it = misses.find(size);
+    if (it != misses.end()) {
+      it->second++;
+    } else if (misses.size() < DXMA_IDLE_HOT_SIZE_COUNT) {
+      misses.emplace(size, 1);
+    }
+  }
+
+  // Split up to count ranges of size bytes from the existing heaps into a
+  // quick list, placed for its lifetime and without creating heaps
+  void PreSplitQuickRanges(UINT32 list_index, UINT64 size, UINT32 count) {
+    D3D12_HEAP_TYPE type = static_cast<D3D12_HEAP_TYPE>(list_index / 3);
+    DxmaLifetime lifetime = static_cast<DxmaLifetime>(list_index % 3);
+    bool top_down = lifetime == DXMA_LIFETIME_TRANSIENT;
+    std::vector<QuickRange>& ranges = quick_lists_[list_index][size];
+    while (count-- > 0 && ranges.size() < quick_list_depth_) {
+      UINT32 heap_index = 0;
+      UINT64 offset = 0;
+      if (page_size_[list_index / 3]) {
+        if (!AllocatePages(type, lifetime, size, 0, &heap_index, &offset)) {
+          break;
+        }
+      } else {
+        FreeBlock* ptr = FindFreeBlock(type, lifetime, size, 0, &heap_index);
+        if (!ptr) break;
+        offset = free_lists_[heap_index].Split(ptr, size, 0, top_down);
+      }
+      UpdateHeapOrder(heap_index);
+      ranges.push_back(QuickRange{heap_index, offset, quick_epoch_});
+      quick_bytes_ += size;
+    }
+    if (ranges.empty()) quick_lists_[list_index].erase(size);
+  }
+
+  // Return the ranges in quick lists to their heaps, all of them or only the
+  // ones that were not reused since the previous flush, returns the number of
+  // returned ranges
+  UINT32 ReturnQuickRanges(bool all) {
+    UINT32 count = 0;
+    for (auto& quick_lists : quick_lists_) {
+      count += ReturnQuickList(quick_lists, all);
+    }
+    quick_adds_ = 0;
+    quick_epoch_++;
+    return count;
+  }
+
+  // Return the quick list ranges of a heap that start in [begin, end) to it
+  void ReturnQuickRangesIn(UINT32 heap_index, UINT64 begin, UINT64 end) {
+    for (UINT32 lifetime = DXMA_LIFETIME_PERMANENT;
+         lifetime <= DXMA_LIFETIME_TRANSIENT; lifetime++) {
+      auto& quick_lists = quick_lists_[QuickListIndex(
+          heap_types_[heap_index], static_cast<DxmaLifetime>(lifetime))];
+      for (auto& quick_list : quick_lists) {
+        std::vector<QuickRange>& ranges = quick_list.second;
+        size_t kept = 0;
+        for (const QuickRange& range : ranges) {
+          if (range.heap_index != heap_index || range.offset < begin ||
+              range.offset >= end) {
+            ranges[kept++] = range;
+            continue;
+          }
+          ReturnRange(heap_index, range.offset, quick_list.first);
+          quick_bytes_ -= quick_list.first;
+        }
+        ranges.resize(kept);
+      }
+    }
+  }
+
+  // Return the ranges of the quick lists of one heap type and lifetime, all
+  // of them or only the ones that were not reused since the previous flush
+  UINT32 ReturnQuickList(
+      std::unordered_map<UINT64, std::vector<QuickRange>>& quick_lists,
+      bool all) {
+    UINT32 count = 0;
+    for (auto it = quick_lists.begin(); it != quick_lists.end();) {
+      std::vector<QuickRange>& ranges = it->second;
+      size_t kept = 0;
+      for (const QuickRange& range : ranges) {
+        if (!all && range.epoch == quick_epoch_) {
+          ranges[kept++] = range;
+          continue;
+        }
+        ReturnRange(range.heap_index, range.offset, it->first);
+        quick_bytes_ -= it->first;
+        count++;
+      }
+      ranges.resize(kept);
+      it = ranges.empty() ? quick_lists.erase(it) : std::next(it);
+    }
+    return count;
+  }
+
+  // Add a request to the decaying size histogram of its heap type
+  void RecordRequestSize(D3D12_HEAP_TYPE type, UINT64 size) {
+    UINT32 index = HeapTypeIndex(type);
+    request_sizes_[index][FloorLog2(size)]++;
+
+    // Halve the histogram regularly so it follows recent requests
+    if (++request_count_[index] >= 1024) {
+      for (UINT32& count : request_sizes_[index]) count /= 2;
+      request_count_[index] /= 2;
+    }
+  }
+
+  // Get the power of two that 90% of the recent requests of a heap type fit
+  UINT64 GetTypicalRequestSize(UINT32 index) const {
+    UINT32 total = 0;
+    for (UINT32 count : request_sizes_[index]) total += count;
+
+    UINT32 seen = 0;
+    for (UINT32 bucket = 0; bucket < 63; bucket++) {
+      seen += request_sizes_[index][bucket];
+      if (seen * 10 >= total * 9 && seen > 0) return 2ull << bucket;
+    }
+    return 0;
+  }
+
+  // Find a free block with room for an aligned range in the heaps of a type
+  // that hold the lifetime, using the configured strategy. Transient
+  // allocations always use the highest free block. heap_index receives its
+  // heap
+  FreeBlock* FindFreeBlock(D3D12_HEAP_TYPE type, DxmaLifetime lifetime,
+                           UINT64 size, UINT64 alignment,
+                           UINT32* heap_index) const {
+    bool level = lifetime == DXMA_LIFETIME_LEVEL;
+    if (lifetime == DXMA_LIFETIME_TRANSIENT) {
+      return FindFreeBlock<LastFit>(type, level, size, alignment, heap_index);
+    }
+
+    switch (strategy_) {
+      case DXMA_ALLOCATION_STRATEGY_FIRST_FIT:
+        return FindFreeBlock<FirstFit>(type, level, size, alignment,
+                                       heap_index);
+      case DXMA_ALLOCATION_STRATEGY_BEST_FIT:
+        return FindFreeBlock<BestFit>(type, level, size, alignment,
+                                      heap_index);
+      default:
+        return FindFreeBlock<FitPolicy>(type, level, size, alignment,
+                                        heap_index);
+    }
+  }
+
+  // Find a free block in the heaps of a type with a fit policy, fullest heap
+  // first. level selects the heaps of level allocations or the shared heaps
+  template <typename Policy>
+  FreeBlock* FindFreeBlock(D3D12_HEAP_TYPE type, bool level, UINT64 size,
+                           UINT64 alignment, UINT32* heap_index) const {
+    // Only heaps with a large enough block are visited, and a new heap is
+    // needed at once if there is none
+    const HeapOrder& order = heap_orders_[HeapTypeIndex(type) * 2 + level];
+    FreeBlock* best = nullptr;
+    for (size_t pos = order.FindFirst(size, 0); pos < order.GetCount();
+         pos = order.FindFirst(size, pos + 1)) {
+      UINT32 i = order.GetHeapIndex(pos);
+
+      FreeBlock* block = Policy::Find(free_lists_[i], size, alignment);
+      if (!block || (best && block->GetSize() >= best->GetSize())) continue;
+
+      best = block;
+      *heap_index = i;
+      if (Policy::kFirstMatch || block->GetSize() == size) break;
+    }
+    return best;
+  }
+
+  // Get the size of the next heap of a type that must hold block_size bytes
+  UINT64 GetNextHeapSize(D3D12_HEAP_TYPE type, UINT64 block_size) const {
+    UINT64 heap_size = GetGrowthHeapSize(type);
+    if (heap_size <= block_size) heap_size = block_size * 4;
+    return heap_size;
+  }
+
+  // Get the size of the next heap of a type from the growth policy alone
+  UINT64 GetGrowthHeapSize(D3D12_HEAP_TYPE type) const {
+    UINT32 index = HeapTypeIndex(type);
+    UINT64 heap_size = preferred_heap_size_[index];
+
+    if (growth_policy_ == DXMA_GROWTH_POLICY_GEOMETRIC) {
+      // Double the memory of the type, but hold a few typical requests
+      UINT64 target = std::max({min_heap_size_, heap_bytes_[index],
+                                GetTypicalRequestSize(index) * 8});
+      target = (target + 0xFFFF) & ~static_cast<UINT64>(0xFFFF);
+      heap_size = std::min(target, heap_size);
+    }
+    return heap_size;
+  }
+
+  // Create the allocation object for a reserved range and register it
+  Allocation* CreateAllocation(const DxmaAllocationInfo& alloc_info,
+                               UINT64 size, UINT64 offset, UINT32 heap_index,
+                               ID3D12Heap* heap
+#ifdef DXMA_DEBUG
+                               ,
+                               UINT64 margin, const char* file, int line
+#endif
+  ) {
+#ifdef DXMA_DEBUG
+    offset += margin;
+#endif
+
+    Allocation* allocation =
+        new Allocation(size, offset, alloc_info.type, heap_index, heap
+#ifdef DXMA_DEBUG
+                       ,
+                       file, line
+#endif
+        );
+
+    if (alloc_info.name) {
+      allocation->SetName(InternName(alloc_info.name),
+                          alloc_info.name_resource);
+    }
+
+    UINT32 tag = alloc_info.tag;
+    if (tag >= DXMA_MAX_TAG_COUNT) {
+      assert(!"Invalid tag passed to dxmaAllocate: tag is too large");
+      tag = DXMA_MAX_TAG_COUNT - 1;
+    }
+    allocation->SetTag(tag);
+    allocation->SetLifetime(alloc_info.lifetime);
+    allocation->SetAlignment(alloc_info.alignment);
+    if constexpr (StatsPolicy::kEnabled) {
+      AddTagAllocation(tag, size);
+      RecordAllocation(alloc_info.type, size);
+    }
+
+#ifdef DXMA_DEBUG
+    allocation->SetMargin(margin);
+    WriteMargins(allocation);
+    if constexpr (TrackingPolicy::kEnabled) AddAllocation(allocation);
+#endif
+#ifdef DXMA_PROFILING
+    if (profiler_) profiler_->OnAllocate(allocation);
+#endif
+#ifdef DXMA_JOURNAL
+    if (journal_) journal_->OnAllocate(allocation);
+#endif
+    return allocation;
+  }
+};
+
+// Allocator used by the C-style API, the policies can be replaced by defining
+// DXMA_FIT_POLICY, DXMA_LOCK_POLICY, DXMA_TRACKING_POLICY and
+// DXMA_STATS_POLICY
+using Allocator = BasicAllocator<DXMA_FIT_POLICY, DXMA_LOCK_POLICY,
+                                 DXMA_TRACKING_POLICY, DXMA_STATS_POLICY>;
+
+// Virtual block used by the C-style API
+using VirtualBlock = BasicVirtualBlock<DXMA_FIT_POLICY>;
+
+// Allocate memory from the allocator
+void dxmaAllocateImpl(Allocator* allocator,
+                      const DxmaAllocationInfo& alloc_info,
+                      Allocation** allocation
+#ifdef DXMA_DEBUG
+                      ,
+                      const char* file, int line
+#endif
+) {
+  allocator->Allocate(alloc_info, allocation
+#ifdef DXMA_DEBUG
+                      ,
+                      file, line
+#endif
+  );
+}
+
+// Contiguous range of a heap with its own offset allocator, used without
+// touching the allocator it was carved from
+class Block {
+ private:
+  Allocation* range_ = nullptr;  // Range reserved from the allocator
+  VirtualBlock offsets_;         // Offsets within the range
+
+ public:
+  // Offsets are managed as heap offsets, so alignments apply to them
+  explicit Block(Allocation* range)
+      : range_(range), offsets_(range->GetSize(), range->GetOffset()) {}
+
+  // Reserve size bytes at a heap offset with the alignment
+  bool Allocate(UINT64 size, UINT64 alignment,
+                DxmaBlockAllocation* allocation) {
+    UINT64 offset = 0;
+    if (!offsets_.Allocate(size, alignment, &offset)) return false;
+
+    allocation->heap = range_->GetHeap();
+    allocation->offset = offset;
+    allocation->size = size;
+    return true;
+  }
+
+  // Return a range reserved with Allocate
+  bool Free(const DxmaBlockAllocation& allocation) {
+    return offsets_.Free(allocation.offset);
+  }
+
+  // Getters
+  Allocation* GetRange() const { return range_; }
+  const VirtualBlock& GetOffsets() const { return offsets_; }
+};
+
+// Reserve a range from the allocator and bind a block to it
+HRESULT dxmaAllocateBlockImpl(Allocator* allocator,
+                              const DxmaAllocationInfo& alloc_info,
+                              Block** block
+#ifdef DXMA_DEBUG
+                              ,
+                              const char* file, int line
+#endif
+) {
+  Allocation* range = nullptr;
+  allocator->Allocate(alloc_info, &range
 #ifdef DXMA_DEBUG
-  allocator->AddAllocation(*allocation);
+                      ,
+                      file, line
 #endif
+  );
+  if (!range) return E_OUTOFMEMORY;
+
+  *block = new Block(range);
+  return S_OK;
 }
 
+// Define handle types for the library user
+#define DEFINE_DXMA_HANDLE(name) typedef dxma_detail::name* Dxma##name;
+
 }  // namespace dxma_detail
 
 // Define handles for Allocation, FreeBlock, and Allocator
 DEFINE_DXMA_HANDLE(Allocation)
 DEFINE_DXMA_HANDLE(FreeBlock)
 DEFINE_DXMA_HANDLE(Allocator)
+DEFINE_DXMA_HANDLE(VirtualBlock)
+DEFINE_DXMA_HANDLE(Block)
 
 // Create a new allocator instance
 void dxmaCreateAllocator(DxmaAllocator* allocator, ID3D12Device* device) {
   *allocator = new dxma_detail::Allocator(device);
 }
 
+// Create a new allocator instance with a runtime configuration
+HRESULT dxmaCreateAllocator(DxmaAllocator* allocator,
+                            const DxmaAllocatorDesc& desc) {
+  if (!desc.device) return E_INVALIDARG;
+  *allocator = new dxma_detail::Allocator(desc);
+  return S_OK;
+}
+
 // Destroy an allocator instance
 void dxmaDestroyAllocator(DxmaAllocator allocator) { delete allocator; }
 
@@ -414,6 +4110,25 @@ HRESULT dxmaCreateResource(DxmaAllocator allocator, DxmaAllocation allocation,
       allocation->GetHeap(), allocation->GetOffset(), resource_desc,
       initial_state, nullptr, IID_PPV_ARGS(&resource));
   allocation->SetResource(resource, auto_manage_resource);
+
+  // Name managed resources after their allocation
+  if (SUCCEEDED(result) && auto_manage_resource && allocation->GetName() &&
+      allocation->ShouldNameResource()) {
+    const char* name = allocation->GetName();
+    wchar_t wide_name[256];
+#ifdef _WIN32
+    if (MultiByteToWideChar(CP_UTF8, 0, name, -1, wide_name, 256) == 0) {
+      wide_name[0] = L'\0';
+    }
+#else
+    size_t i = 0;
+    for (; name[i] != '\0' && i < 255; i++) {
+      wide_name[i] = static_cast<wchar_t>(static_cast<unsigned char>(name[i]));
+    }
+    wide_name[i] = L'\0';
+#endif
+    resource->SetName(wide_name);
+  }
   return result;
 }
 
@@ -461,72 +4176,379 @@ inline void dxmaAllocate(DxmaAllocator allocator,
 }
 #endif
 
-// Free a memory allocation
-void dxmaFree(DxmaAllocator allocator, DxmaAllocation allocation,
-              ID3D12Resource* resource = nullptr) {
-  if (allocation->GetSize() == 0 || allocation->GetHeap() == nullptr) {
-    assert(!"Invalid allocation passed to dxmaFree: size is 0 or heap is null");
-    return;
+#ifdef DXMA_DEBUG
+// Reserve a contiguous heap range of alloc_info.size bytes as a block that
+// sub-allocates without the allocator's structures or locks
+#define dxmaAllocateBlock(allocator, alloc_info, block)                  \
+  dxma_detail::dxmaAllocateBlockImpl(allocator, alloc_info, block,       \
+                                     __FILE__, __LINE__)
+#else
+// Reserve a contiguous heap range of alloc_info.size bytes as a block that
+// sub-allocates without the allocator's structures or locks
+inline HRESULT dxmaAllocateBlock(DxmaAllocator allocator,
+                                 const DxmaAllocationInfo& alloc_info,
+                                 DxmaBlock* block) {
+  return dxma_detail::dxmaAllocateBlockImpl(allocator, alloc_info, block);
+}
+#endif
+
+// Reserve size bytes from a block at a heap offset with the alignment, so the
+// range can hold a placed resource
+HRESULT dxmaBlockAllocate(DxmaBlock block, UINT64 size, UINT64 alignment,
+                          DxmaBlockAllocation* allocation) {
+  return block->Allocate(size, alignment, allocation) ? S_OK : E_OUTOFMEMORY;
+}
+
+// Return a range to its block
+void dxmaBlockFree(DxmaBlock block, const DxmaBlockAllocation& allocation) {
+  if (!block->Free(allocation)) {
+    assert(!"Invalid allocation passed to dxmaBlockFree: not from this block");
   }
+}
 
-#ifdef DXMA_DEBUG
-  if (allocator->RemoveAllocation(allocation) != 1) {
-    assert(
-        !"Invalid allocation passed to dxmaFree: allocation was not tracked");
-    return;
+// Get the usage and free ranges of a block
+void dxmaGetBlockStats(DxmaBlock block, DxmaVirtualBlockStats* stats) {
+  block->GetOffsets().GetStats(stats);
+}
+
+// Return the whole range of a block to its allocator, ranges still reserved
+// from the block are released with it
+void dxmaDestroyBlock(DxmaAllocator allocator, DxmaBlock block) {
+  allocator->Free(block->GetRange(), nullptr);
+  delete block;
+}
+
+// Get the live count, live bytes and peak bytes of all allocations with a tag
+void dxmaGetTagStats(DxmaAllocator allocator, UINT32 tag, DxmaTagStats* stats) {
+  assert(tag < DXMA_MAX_TAG_COUNT);
+  *stats = allocator->GetTagStats(tag);
+}
+
+// Get the current values and high-water marks of a heap type
+void dxmaGetHeapTypeStats(DxmaAllocator allocator, D3D12_HEAP_TYPE type,
+                          DxmaHeapTypeStats* stats) {
+  *stats = allocator->GetHeapTypeStats()[dxma_detail::HeapTypeIndex(type)];
+}
+
+// Reset the high-water marks of all heap types and tags to their current
+// values (e.g. when a level is loaded)
+void dxmaResetPeakStats(DxmaAllocator allocator) {
+  allocator->ResetPeakStats();
+}
+
+// Start counting allocations, frees and heap creations of a frame
+void dxmaBeginFrame(DxmaAllocator allocator, UINT64 frame_index) {
+  allocator->BeginFrame(frame_index);
+}
+
+// Get the activity since the matching dxmaBeginFrame call
+void dxmaEndFrame(DxmaAllocator allocator, DxmaFrameStats* stats) {
+  *stats = allocator->GetFrameStats();
+}
+
+// Create a virtual block managing offsets in [0, size) without any heap, e.g.
+// for sub-allocating a large buffer or descriptor heap
+HRESULT dxmaCreateVirtualBlock(DxmaVirtualBlock* block, UINT64 size) {
+  if (size == 0) return E_INVALIDARG;
+  *block = new dxma_detail::VirtualBlock(size);
+  return S_OK;
+}
+
+// Destroy a virtual block, its allocations don't need to be freed first
+void dxmaDestroyVirtualBlock(DxmaVirtualBlock block) { delete block; }
+
+// Reserve size bytes at an offset aligned to a power of two alignment
+HRESULT dxmaVirtualAllocate(DxmaVirtualBlock block, UINT64 size,
+                            UINT64 alignment, UINT64* offset) {
+  return block->Allocate(size, alignment, offset) ? S_OK : E_OUTOFMEMORY;
+}
+
+// Return the allocation made at offset to its virtual block
+void dxmaVirtualFree(DxmaVirtualBlock block, UINT64 offset) {
+  if (!block->Free(offset)) {
+    assert(!"Invalid offset passed to dxmaVirtualFree: no allocation found");
   }
+}
+
+// Return all allocations of a virtual block at once
+void dxmaClearVirtualBlock(DxmaVirtualBlock block) { block->Clear(); }
+
+// Get the usage and free ranges of a virtual block
+void dxmaGetVirtualBlockStats(DxmaVirtualBlock block,
+                              DxmaVirtualBlockStats* stats) {
+  block->GetStats(stats);
+}
+
+// Release empty heaps, smallest first, until releasing the next one would
+// exceed max_release_bytes, returns the number of released heaps
+UINT32 dxmaTrim(DxmaAllocator allocator,
+                UINT64 max_release_bytes = UINT64_MAX) {
+  return allocator->Trim(max_release_bytes);
+}
+
+// Return all ranges held in quick lists to their heaps so they are coalesced
+// (e.g. after a loading screen), returns the number of returned ranges
+UINT32 dxmaFlushQuickLists(DxmaAllocator allocator) {
+  return allocator->FlushQuickLists();
+}
+
+// Merge all frees collected with pending_free_limit into their heaps' free
+// lists (e.g. once per frame), returns the number of merged ranges
+UINT32 dxmaCoalesce(DxmaAllocator allocator) {
+  return allocator->Coalesce();
+}
+
+// Do deferred maintenance for up to microseconds during frame slack: return
+// unused quick list ranges, merge pending frees, pre-split ranges for
+// missed quick list sizes and keep each heap type's heaps at its peak
+// allocation size, returns true if all of it was done
+bool dxmaIdle(DxmaAllocator allocator, UINT64 microseconds) {
+  return allocator->Idle(microseconds);
+}
+
+#ifdef DXMA_TIMING
+// Get the latency histogram of an allocator phase
+void dxmaGetTimingHistogram(DxmaAllocator allocator, DxmaTimingPhase phase,
+                            DxmaTimingHistogram* histogram) {
+  allocator->GetTimingHistogram(phase).Read(histogram);
+}
+
+// Reset the latency histograms of all phases, e.g. once per frame
+void dxmaResetTimingHistograms(DxmaAllocator allocator) {
+  allocator->ResetTimingHistograms();
+}
 #endif
 
-  DxmaFreeBlock new_block = new dxma_detail::FreeBlock(
-      allocation->GetSize(), allocation->GetOffset(), allocation->GetHeapType(),
-      allocation->GetHeapIndex(), nullptr, allocation->GetHeap());
+#ifdef DXMA_TRACE
+// Start writing allocator events (heap creations and allocations taking at
+// least long_allocation_ns) as Chrome trace-event JSON to a file, which can be
+// opened in chrome://tracing or the Perfetto UI
+HRESULT dxmaBeginTrace(DxmaAllocator allocator, const char* path,
+                       UINT64 long_allocation_ns = 50000) {
+  if (allocator->GetTraceSink()) return E_FAIL;
 
-  DxmaFreeBlock head = allocator->GetHead();
-  if (!head) {
-    allocator->SetHead(new_block);
-    return;
+  FILE* file = nullptr;
+#ifdef _MSC_VER
+  if (fopen_s(&file, path, "w") != 0) file = nullptr;
+#else
+  file = std::fopen(path, "w");
+#endif
+  if (!file) return E_FAIL;
+
+  allocator->SetTraceSink(
+      new dxma_detail::TraceSink(file, long_allocation_ns));
+  return S_OK;
+}
+
+// Stop tracing, flush all buffered events and close the file
+void dxmaEndTrace(DxmaAllocator allocator) {
+  delete allocator->GetTraceSink();
+  allocator->SetTraceSink(nullptr);
+}
+#endif
+
+#ifdef DXMA_JOURNAL
+// Open a crash-safe journal of the last record_count allocator events in a
+// memory-mapped file, the heaps created so far are recorded first
+HRESULT dxmaOpenJournal(DxmaAllocator allocator, const char* path,
+                        UINT64 record_count = 65536) {
+  if (allocator->GetJournal()) return E_FAIL;
+
+  dxma_detail::Journal* journal = new dxma_detail::Journal();
+  if (!journal->Open(path, allocator->GetMaxHeapCount(), record_count)) {
+    delete journal;
+    return E_FAIL;
+  }
+
+  ID3D12Heap** heaps = allocator->GetHeaps();
+  for (UINT32 i = 0; i < allocator->GetHeapCount(); i++) {
+    if (!heaps[i]) continue;
+    D3D12_HEAP_DESC heap_desc = heaps[i]->GetDesc();
+    journal->OnCreateHeap(i, heap_desc.Properties.Type,
+                          heap_desc.SizeInBytes);
   }
 
-  DxmaFreeBlock prev = nullptr;
-  DxmaFreeBlock current = head;
+  allocator->SetJournal(journal);
+  return S_OK;
+}
+
+// Write a final summary and close the journal
+void dxmaCloseJournal(DxmaAllocator allocator) {
+  delete allocator->GetJournal();
+  allocator->SetJournal(nullptr);
+}
+#endif
 
-  // Find the correct position to insert the new block
-  while (current && (current->GetHeapIndex() != allocation->GetHeapIndex() ||
-                     current->GetOffset() < allocation->GetOffset())) {
-    prev = current;
-    current = current->GetNext();
+#ifdef DXMA_SHARED_STATS
+// Publish the allocator statistics to a memory-mapped region at path, which
+// an external monitor can sample with dxmaReadSharedStats
+HRESULT dxmaOpenSharedStats(DxmaAllocator allocator, const char* path) {
+  if (allocator->GetSharedStats()) return E_FAIL;
+
+  dxma_detail::SharedStats* shared_stats = new dxma_detail::SharedStats();
+  if (!shared_stats->Open(path)) {
+    delete shared_stats;
+    return E_FAIL;
   }
 
-  // Release the resource if it's not managed by the allocation
-  if (resource && !allocation->GetResource()) {
-    resource->Release();
+  shared_stats->UpdateCounts(allocator->GetHeapTypeStats());
+  shared_stats->UpdateFreeBlocks(*allocator);
+  shared_stats->Publish();
+
+  allocator->SetSharedStats(shared_stats);
+  return S_OK;
+}
+
+// Copy the heap, allocation and free block statistics, which are not
+// published on every allocation, and publish them with the given memory
+// budget (e.g. once per frame)
+void dxmaPublishStats(DxmaAllocator allocator, UINT64 budget_bytes = 0) {
+  dxma_detail::SharedStats* shared_stats = allocator->GetSharedStats();
+  if (!shared_stats) return;
+
+  shared_stats->GetStats().budget_bytes = budget_bytes;
+  shared_stats->UpdateCounts(allocator->GetHeapTypeStats());
+  shared_stats->UpdateFreeBlocks(*allocator);
+  shared_stats->Publish();
+}
+
+// Stop publishing statistics and unmap the region
+void dxmaCloseSharedStats(DxmaAllocator allocator) {
+  delete allocator->GetSharedStats();
+  allocator->SetSharedStats(nullptr);
+}
+
+// Read a consistent copy of the statistics from a mapped region, usable from
+// another process, returns false if the region is not valid or no consistent
+// copy was read in max_attempts (e.g. the process stopped during a publish)
+bool dxmaReadSharedStats(const DxmaSharedStatsRegion* region,
+                         DxmaSharedStats* stats, UINT32 max_attempts = 1024) {
+  if (region->magic != DXMA_SHARED_STATS_MAGIC ||
+      region->version != DXMA_SHARED_STATS_VERSION) {
+    return false;
   }
 
-  delete allocation;
-  allocation = nullptr;
+  for (UINT32 attempt = 0; attempt < max_attempts; attempt++) {
+    UINT64 sequence = region->sequence.load(std::memory_order_acquire);
+    if (sequence & 1) continue;
 
-  // Merge with the previous block if possible
-  if (prev && prev->GetOffset() + prev->GetSize() == new_block->GetOffset() &&
-      prev->GetHeapIndex() == new_block->GetHeapIndex()) {
-    prev->SetSize(prev->GetSize() + new_block->GetSize());
-    delete new_block;
-    new_block = prev;
-  } else {
-    // Insert the new block
-    if (prev) {
-      prev->SetNext(new_block);
-    } else {
-      allocator->SetHead(new_block);
+    memcpy(stats, &region->stats, sizeof(DxmaSharedStats));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (region->sequence.load(std::memory_order_relaxed) == sequence) {
+      return true;
     }
-    new_block->SetNext(current);
   }
+  return false;
+}
+#endif
+
+#ifdef DXMA_PROFILING
+// Sample on average one allocation per sample_interval bytes and record its
+// call stack, capture_stack replaces the platform unwinder if not null, an
+// interval of 0 stops sampling while keeping the recorded stacks
+void dxmaEnableSampling(DxmaAllocator allocator, UINT64 sample_interval,
+                        PFN_dxmaCaptureStack capture_stack = nullptr,
+                        void* user_data = nullptr) {
+  allocator->GetOrCreateProfiler()->Configure(sample_interval, capture_stack,
+                                              user_data);
+}
+
+// Write up to max_reports call stacks with the most live sampled bytes,
+// largest first, and return the number of reports written
+UINT32 dxmaGetTopAllocationStacks(DxmaAllocator allocator,
+                                  DxmaStackReport* reports,
+                                  UINT32 max_reports) {
+  dxma_detail::SamplingProfiler* profiler = allocator->GetProfiler();
+  return profiler ? profiler->GetTopStacks(reports, max_reports) : 0;
+}
+#endif
+
+#ifdef DXMA_DEBUG
+// Function called for every allocation by dxmaEnumerateAllocations
+typedef void (*PFN_dxmaAllocationCallback)(DxmaAllocation allocation,
+                                           void* user_data);
+
+// Call a function for every live allocation without copying the tracking
+// list, the function may free the allocation it is called with
+void dxmaEnumerateAllocations(DxmaAllocator allocator,
+                              PFN_dxmaAllocationCallback callback,
+                              void* user_data = nullptr) {
+  allocator->EnumerateAllocations(callback, user_data);
+}
+
+// Capture all live allocations into a flat array sorted by allocation id,
+// release it with dxmaFreeSnapshot
+void dxmaTakeSnapshot(DxmaAllocator allocator, DxmaSnapshot* snapshot) {
+  allocator->TakeSnapshot(snapshot);
+}
+
+// Release the entries of a snapshot
+void dxmaFreeSnapshot(DxmaSnapshot* snapshot) {
+  delete[] snapshot->entries;
+  *snapshot = DxmaSnapshot{};
+}
+
+// Find the allocations made after the earlier snapshot that are still alive in
+// the later one, the result points into the later snapshot
+void dxmaDiffSnapshots(const DxmaSnapshot& earlier, const DxmaSnapshot& later,
+                       DxmaSnapshotDiff* diff) {
+  const DxmaSnapshotEntry* begin = later.entries;
+  const DxmaSnapshotEntry* end = later.entries + later.entry_count;
 
-  // Merge with the next block if possible
-  if (current &&
-      new_block->GetOffset() + new_block->GetSize() == current->GetOffset() &&
-      current->GetHeapIndex() == new_block->GetHeapIndex()) {
-    new_block->SetSize(new_block->GetSize() + current->GetSize());
-    new_block->SetNext(current->GetNext());
-    delete current;
+  // Entries are sorted by id, so all newer allocations form the tail
+  const DxmaSnapshotEntry* first = std::lower_bound(
+      begin, end, earlier.next_id,
+      [](const DxmaSnapshotEntry& entry, UINT64 id) { return entry.id < id; });
+
+  diff->entries = first;
+  diff->entry_count = static_cast<UINT64>(end - first);
+  diff->total_bytes = 0;
+  for (const DxmaSnapshotEntry* entry = first; entry != end; entry++) {
+    diff->total_bytes += entry->size;
   }
+}
+
+// Place margins filled with a pattern around allocations in UPLOAD and
+// READBACK heaps and fill freed memory with a second pattern, must be called
+// before the first allocation
+HRESULT dxmaEnableCorruptionDetection(DxmaAllocator allocator) {
+  return allocator->EnableCorruptionDetection() ? S_OK : E_FAIL;
+}
+
+// Check the margins of all allocations and the contents of all freed memory
+// in UPLOAD and READBACK heaps, prints where corrupted allocations were made
+// and returns the number of corrupted ranges
+UINT32 dxmaCheckCorruption(DxmaAllocator allocator) {
+  return allocator->CheckCorruption();
+}
+
+// Function called for every call site by dxmaEnumerateCallSites
+typedef void (*PFN_dxmaCallSiteCallback)(const DxmaCallSiteStats* site,
+                                         void* user_data);
+
+// Call a function with the live count, live bytes and peak bytes of every
+// dxmaAllocate call site, maintained incrementally on allocate and free
+void dxmaEnumerateCallSites(DxmaAllocator allocator,
+                            PFN_dxmaCallSiteCallback callback,
+                            void* user_data = nullptr) {
+  allocator->EnumerateCallSites(callback, user_data);
+}
+#endif
+
+// Free a memory allocation
+void dxmaFree(DxmaAllocator allocator, DxmaAllocation allocation,
+              ID3D12Resource* resource = nullptr) {
+  allocator->Free(allocation, resource);
+}
+
+// Resize an allocation in place, growing it into the free range directly
+// after it in its heap or returning its tail when it shrinks. Returns false if
+// it cannot grow in place, then a new allocation is needed and the contents
+// must be copied. Placed resources keep their size, so one of the new size is
+// created at the same offset. After a shrink, a resource managed by the
+// allocation keeps its old size while the tail is reused, so it must not be
+// accessed past the new size
+bool dxmaResize(DxmaAllocator allocator, DxmaAllocation allocation,
+                UINT64 new_size) {
+  return allocator->Resize(allocation, new_size);
 }
\ No newline at end of file
@@ -3,7 +3,17 @@
 #include <gtest/gtest.h>
 #include <wrl/client.h>
 
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
 #define DXMA_DEBUG
+#define DXMA_TIMING
+#define DXMA_TRACE
+#define DXMA_PROFILING
+#define DXMA_JOURNAL
+#define DXMA_SHARED_STATS
 #include "dxma.h"
 
 using Microsoft::WRL::ComPtr;
@@ -271,6 +281,1442 @@ TEST_F(DirectXMemoryAllocatorTest, MapAndUnmapMemoryForCpuAccess) {
   dxmaFree(memoryAllocator_, allocation);
 }
 
+// Test case: Record allocator phase timings and reset them
+TEST_F(DirectXMemoryAllocatorTest, RecordAndResetTimingHistograms) {
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 1024;                    // 1 KB
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;  // CPU-accessible heap
+
+  // The first allocation creates a heap, the second one splits a free block
+  DxmaAllocation allocation1 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation1);
+  DxmaAllocation allocation2 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation2);
+
+  dxmaFree(memoryAllocator_, allocation1, nullptr);
+  dxmaFree(memoryAllocator_, allocation2, nullptr);
+
+  DxmaTimingHistogram histogram{};
+  dxmaGetTimingHistogram(memoryAllocator_, DXMA_TIMING_PHASE_CREATE_HEAP,
+                         &histogram);
+  ASSERT_EQ(histogram.count, 1);
+
+  dxmaGetTimingHistogram(memoryAllocator_, DXMA_TIMING_PHASE_ALLOCATE_METADATA,
+                         &histogram);
+  ASSERT_EQ(histogram.count, 2);
+
+  UINT64 bucketTotal = 0;
+  for (UINT64 bucket : histogram.buckets) bucketTotal += bucket;
+  ASSERT_EQ(bucketTotal, histogram.count);
+
+  dxmaGetTimingHistogram(memoryAllocator_, DXMA_TIMING_PHASE_FREE_MERGE,
+                         &histogram);
+  ASSERT_EQ(histogram.count, 2);
+
+  // Reset all histograms
+  dxmaResetTimingHistograms(memoryAllocator_);
+  dxmaGetTimingHistogram(memoryAllocator_, DXMA_TIMING_PHASE_CREATE_HEAP,
+                         &histogram);
+  ASSERT_EQ(histogram.count, 0);
+}
+
+// Test case: Write allocator events as Chrome trace-event JSON
+TEST_F(DirectXMemoryAllocatorTest, WriteTraceEvents) {
+  const char* tracePath = "dxma_trace_test.json";
+
+  // Record every allocation regardless of its duration
+  ASSERT_TRUE(SUCCEEDED(dxmaBeginTrace(memoryAllocator_, tracePath, 0)));
+  ASSERT_FALSE(SUCCEEDED(dxmaBeginTrace(memoryAllocator_, tracePath, 0)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 1024;                     // 1 KB
+  allocationInfo.type = D3D12_HEAP_TYPE_DEFAULT;  // GPU-accessible heap
+
+  DxmaAllocation allocation = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation);
+  dxmaFree(memoryAllocator_, allocation, nullptr);
+
+  dxmaEndTrace(memoryAllocator_);
+
+  std::ifstream file(tracePath);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  file.close();
+  std::remove(tracePath);
+
+  std::string trace = contents.str();
+  ASSERT_EQ(trace.find("{\"traceEvents\":["), 0);
+  ASSERT_NE(trace.find("\"name\":\"CreateHeap\""), std::string::npos);
+  ASSERT_NE(trace.find("\"name\":\"Allocate\""), std::string::npos);
+  ASSERT_NE(trace.find("]"), std::string::npos);
+}
+
+// Test case: Enumerate live allocations and free them from the callback
+TEST_F(DirectXMemoryAllocatorTest, EnumerateAndFreeAllocations) {
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 256;                     // 256 bytes
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;  // CPU-accessible heap
+
+  DxmaAllocation allocations[4]{};
+  for (DxmaAllocation& allocation : allocations) {
+    dxmaAllocate(memoryAllocator_, allocationInfo, &allocation);
+  }
+  ASSERT_EQ(memoryAllocator_->GetAllocationCount(), 4);
+
+  // Free the second allocation, the remaining ones keep allocation order
+  dxmaFree(memoryAllocator_, allocations[1], nullptr);
+  ASSERT_EQ(memoryAllocator_->GetAllocationCount(), 3);
+
+  struct EnumerateContext {
+    DxmaAllocator allocator;
+    UINT64 offsets[4];
+    uint32_t count;
+  } context{memoryAllocator_, {}, 0};
+
+  dxmaEnumerateAllocations(
+      memoryAllocator_,
+      [](DxmaAllocation allocation, void* userData) {
+        auto* callbackContext = static_cast<EnumerateContext*>(userData);
+        callbackContext->offsets[callbackContext->count++] =
+            allocation->GetOffset();
+        dxmaFree(callbackContext->allocator, allocation, nullptr);
+      },
+      &context);
+
+  ASSERT_EQ(context.count, 3);
+  ASSERT_EQ(context.offsets[0], 0);
+  ASSERT_EQ(context.offsets[1], 512);
+  ASSERT_EQ(context.offsets[2], 768);
+
+  // All allocations were freed during enumeration
+  ASSERT_EQ(memoryAllocator_->GetAllocationCount(), 0);
+  ASSERT_EQ(memoryAllocator_->GetFreeBlockCount(), 1);
+}
+
+// Test case: Sample allocations and report live bytes per call stack
+TEST_F(DirectXMemoryAllocatorTest, SampleAllocationsByCallStack) {
+  // Report the frame pointed to by the user data as the only stack frame
+  void* frame = nullptr;
+  PFN_dxmaCaptureStack captureStack = [](void** frames, UINT32 /*maxFrames*/,
+                                         void* userData) -> UINT32 {
+    frames[0] = *static_cast<void**>(userData);
+    return 1;
+  };
+
+  // Sample every allocation
+  dxmaEnableSampling(memoryAllocator_, 1, captureStack, &frame);
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 256;                     // 256 bytes
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;  // CPU-accessible heap
+
+  int siteA = 0;
+  frame = &siteA;
+  DxmaAllocation allocationsA[3]{};
+  for (DxmaAllocation& allocation : allocationsA) {
+    dxmaAllocate(memoryAllocator_, allocationInfo, &allocation);
+  }
+
+  int siteB = 0;
+  frame = &siteB;
+  allocationInfo.size = 1024;  // 1 KB
+  DxmaAllocation allocationB = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocationB);
+
+  DxmaStackReport reports[4]{};
+  ASSERT_EQ(dxmaGetTopAllocationStacks(memoryAllocator_, reports, 4), 2);
+  ASSERT_EQ(reports[0].frames[0], &siteB);
+  ASSERT_EQ(reports[0].live_bytes, 1024);
+  ASSERT_EQ(reports[1].frames[0], &siteA);
+  ASSERT_EQ(reports[1].live_bytes, 768);
+  ASSERT_EQ(reports[1].live_allocations, 3);
+
+  // Freed allocations are removed from their stack
+  dxmaFree(memoryAllocator_, allocationB, nullptr);
+  ASSERT_EQ(dxmaGetTopAllocationStacks(memoryAllocator_, reports, 4), 1);
+  ASSERT_EQ(reports[0].frames[0], &siteA);
+
+  for (DxmaAllocation allocation : allocationsA) {
+    dxmaFree(memoryAllocator_, allocation, nullptr);
+  }
+  ASSERT_EQ(dxmaGetTopAllocationStacks(memoryAllocator_, reports, 4), 0);
+}
+
+// Test case: Aggregate live and peak memory per call site
+TEST_F(DirectXMemoryAllocatorTest, AggregateMemoryPerCallSite) {
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 256;                     // 256 bytes
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;  // CPU-accessible heap
+
+  // Allocate three blocks from the same call site
+  DxmaAllocation allocations[3]{};
+  for (DxmaAllocation& allocation : allocations) {
+    dxmaAllocate(memoryAllocator_, allocationInfo, &allocation);
+  }
+  const int allocateLine = __LINE__ - 2;
+
+  dxmaFree(memoryAllocator_, allocations[0], nullptr);
+
+  struct CallSiteContext {
+    int line;
+    DxmaCallSiteStats stats;
+    uint32_t count;
+  } context{allocateLine, {}, 0};
+
+  dxmaEnumerateCallSites(
+      memoryAllocator_,
+      [](const DxmaCallSiteStats* site, void* userData) {
+        auto* callbackContext = static_cast<CallSiteContext*>(userData);
+        if (site->line == callbackContext->line) {
+          callbackContext->stats = *site;
+          callbackContext->count++;
+        }
+      },
+      &context);
+
+  ASSERT_EQ(context.count, 1);
+  ASSERT_EQ(context.stats.live_count, 2);
+  ASSERT_EQ(context.stats.live_bytes, 512);
+  ASSERT_EQ(context.stats.peak_bytes, 768);
+  ASSERT_EQ(context.stats.total_count, 3);
+
+  dxmaFree(memoryAllocator_, allocations[1], nullptr);
+  dxmaFree(memoryAllocator_, allocations[2], nullptr);
+}
+
+// Test case: Name allocations and account them per tag
+TEST_F(DirectXMemoryAllocatorTest, NameAndTagAllocations) {
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 1024;                    // 1 KB
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;  // CPU-accessible heap
+  allocationInfo.tag = 3;
+
+  // Names are copied, so the source buffer may change afterwards
+  char name[] = "geometry";
+  allocationInfo.name = name;
+
+  DxmaAllocation allocation1 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation1);
+  DxmaAllocation allocation2 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation2);
+  name[0] = 'G';
+
+  ASSERT_STREQ(allocation1->GetName(), "geometry");
+  ASSERT_EQ(allocation1->GetName(), allocation2->GetName());
+  ASSERT_EQ(allocation1->GetTag(), 3);
+
+  DxmaTagStats stats{};
+  dxmaGetTagStats(memoryAllocator_, 3, &stats);
+  ASSERT_EQ(stats.live_count, 2);
+  ASSERT_EQ(stats.live_bytes, 2048);
+
+  dxmaFree(memoryAllocator_, allocation1, nullptr);
+  dxmaFree(memoryAllocator_, allocation2, nullptr);
+
+  dxmaGetTagStats(memoryAllocator_, 3, &stats);
+  ASSERT_EQ(stats.live_count, 0);
+  ASSERT_EQ(stats.live_bytes, 0);
+  ASSERT_EQ(stats.peak_bytes, 2048);
+
+  // Untagged allocations are accounted to tag 0
+  dxmaGetTagStats(memoryAllocator_, 0, &stats);
+  ASSERT_EQ(stats.peak_bytes, 0);
+}
+
+// Test case: Find allocations made between two snapshots
+TEST_F(DirectXMemoryAllocatorTest, DiffSnapshots) {
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 256;                     // 256 bytes
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;  // CPU-accessible heap
+
+  DxmaAllocation allocationBefore = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocationBefore);
+
+  DxmaSnapshot earlier{};
+  dxmaTakeSnapshot(memoryAllocator_, &earlier);
+  ASSERT_EQ(earlier.entry_count, 1);
+
+  // Allocate two blocks and free the first one again
+  DxmaAllocation allocationFreed = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocationFreed);
+  allocationInfo.size = 512;  // 512 bytes
+  allocationInfo.tag = 2;
+  DxmaAllocation allocationAlive = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocationAlive);
+  const int allocateAliveLine = __LINE__ - 1;
+  dxmaFree(memoryAllocator_, allocationFreed, nullptr);
+
+  DxmaSnapshot later{};
+  dxmaTakeSnapshot(memoryAllocator_, &later);
+  ASSERT_EQ(later.entry_count, 2);
+  ASSERT_LT(later.entries[0].id, later.entries[1].id);
+
+  DxmaSnapshotDiff diff{};
+  dxmaDiffSnapshots(earlier, later, &diff);
+  ASSERT_EQ(diff.entry_count, 1);
+  ASSERT_EQ(diff.total_bytes, 512);
+  ASSERT_EQ(diff.entries[0].size, 512);
+  ASSERT_EQ(diff.entries[0].tag, 2);
+  ASSERT_EQ(diff.entries[0].line, allocateAliveLine);
+
+  dxmaFreeSnapshot(&earlier);
+  dxmaFreeSnapshot(&later);
+  ASSERT_EQ(later.entries, nullptr);
+
+  dxmaFree(memoryAllocator_, allocationBefore, nullptr);
+  dxmaFree(memoryAllocator_, allocationAlive, nullptr);
+}
+
+// Test case: Detect writes past the end of an upload allocation
+TEST_F(DirectXMemoryAllocatorTest, DetectCorruptedMargins) {
+  ASSERT_TRUE(SUCCEEDED(dxmaEnableCorruptionDetection(memoryAllocator_)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 256;                     // 256 bytes
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;  // CPU-accessible heap
+
+  DxmaAllocation allocation1 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation1);
+  DxmaAllocation allocation2 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation2);
+
+  // Allocations are separated by margins
+  ASSERT_EQ(allocation1->GetOffset(), DXMA_DEBUG_MARGIN);
+  ASSERT_EQ(allocation2->GetOffset(), 3 * DXMA_DEBUG_MARGIN + 256);
+
+  // Detection can only be enabled before the first heap is created
+  ASSERT_FALSE(SUCCEEDED(dxmaEnableCorruptionDetection(memoryAllocator_)));
+
+  D3D12_RESOURCE_DESC resourceDesc{};
+  resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+  resourceDesc.Width = allocationInfo.size;
+  resourceDesc.Height = 1;
+  resourceDesc.DepthOrArraySize = 1;
+  resourceDesc.MipLevels = 1;
+  resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
+  resourceDesc.SampleDesc.Count = 1;
+  resourceDesc.SampleDesc.Quality = 0;
+  resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+  resourceDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
+
+  HRESULT hr = dxmaCreateResource(memoryAllocator_, allocation1, &resourceDesc,
+                                  D3D12_RESOURCE_STATE_GENERIC_READ);
+  ASSERT_TRUE(SUCCEEDED(hr));
+
+  void* mappedData = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaMapMemory(allocation1, &mappedData)));
+  UINT8* bytes = static_cast<UINT8*>(mappedData);
+
+  // Writes inside the allocation are fine
+  memset(bytes, 0, 256);
+  ASSERT_EQ(dxmaCheckCorruption(memoryAllocator_), 0);
+
+  // Write one byte past the end
+  UINT8 original = bytes[256];
+  bytes[256] = static_cast<UINT8>(~original);
+  ASSERT_EQ(dxmaCheckCorruption(memoryAllocator_), 1);
+
+  bytes[256] = original;
+  ASSERT_EQ(dxmaCheckCorruption(memoryAllocator_), 0);
+
+  dxmaFree(memoryAllocator_, allocation1);
+  dxmaFree(memoryAllocator_, allocation2, nullptr);
+  ASSERT_EQ(dxmaCheckCorruption(memoryAllocator_), 0);
+  ASSERT_EQ(memoryAllocator_->GetFreeBlockCount(), 1);
+}
+
+// Test case: Read the journal of an allocator after it was closed
+TEST_F(DirectXMemoryAllocatorTest, ReadJournalAfterClose) {
+  const char* path = "dxma_journal_test.bin";
+  ASSERT_TRUE(SUCCEEDED(dxmaOpenJournal(memoryAllocator_, path, 8)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 1024;                     // 1 KB
+  allocationInfo.type = D3D12_HEAP_TYPE_DEFAULT;  // GPU-only heap
+
+  DxmaAllocation allocation1 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation1);
+  DxmaAllocation allocation2 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation2);
+  UINT64 offset = allocation1->GetOffset();
+  dxmaFree(memoryAllocator_, allocation1);
+
+  // Closing writes the final summary
+  dxmaCloseJournal(memoryAllocator_);
+
+  std::ifstream file(path, std::ios::binary);
+  std::string contents((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+  file.close();
+  std::remove(path);
+
+  // The heap table is sized by the allocator's heap limit
+  const DxmaJournalHeader* header =
+      reinterpret_cast<const DxmaJournalHeader*>(contents.data());
+  ASSERT_EQ(header->heap_capacity, DXMA_MAX_HEAP_COUNT);
+  ASSERT_EQ(contents.size(), sizeof(DxmaJournalHeader) +
+                                 DXMA_MAX_HEAP_COUNT * sizeof(DxmaJournalHeap) +
+                                 8 * sizeof(DxmaJournalRecord));
+
+  const DxmaJournalHeap* heaps =
+      reinterpret_cast<const DxmaJournalHeap*>(header + 1);
+  const DxmaJournalRecord* records =
+      reinterpret_cast<const DxmaJournalRecord*>(heaps +
+                                                 header->heap_capacity);
+  ASSERT_EQ(header->magic, DXMA_JOURNAL_MAGIC);
+  ASSERT_EQ(header->next_sequence.load(), 4);
+  ASSERT_EQ(header->summary_sequence.load() % 2, 0);
+  ASSERT_EQ(header->summary_record, 4);
+  ASSERT_EQ(header->live_allocations, 1);
+  ASSERT_EQ(header->live_bytes[D3D12_HEAP_TYPE_DEFAULT], 1024);
+  ASSERT_EQ(header->heap_count, 1);
+  ASSERT_EQ(heaps[0].type, D3D12_HEAP_TYPE_DEFAULT);
+
+  ASSERT_EQ(records[0].event, DXMA_JOURNAL_EVENT_CREATE_HEAP);
+  ASSERT_EQ(records[1].event, DXMA_JOURNAL_EVENT_ALLOCATE);
+  ASSERT_EQ(records[3].sequence.load(), 4);
+  ASSERT_EQ(records[3].event, DXMA_JOURNAL_EVENT_FREE);
+  ASSERT_EQ(records[3].offset, offset);
+  ASSERT_EQ(records[3].size, 1024);
+  ASSERT_EQ(records[4].sequence.load(), 0);
+
+  dxmaFree(memoryAllocator_, allocation2);
+}
+
+// Test case: Keep the journal summary consistent for allocations made before
+// the journal was opened
+TEST_F(DirectXMemoryAllocatorTest, OpenJournalWithLiveAllocations) {
+  const char* path = "dxma_journal_live_test.bin";
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 4096;                     // 4 KB
+  allocationInfo.type = D3D12_HEAP_TYPE_DEFAULT;  // GPU-only heap
+
+  DxmaAllocation before = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &before);
+  ASSERT_TRUE(SUCCEEDED(dxmaOpenJournal(memoryAllocator_, path, 8)));
+
+  DxmaAllocation after = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &after);
+  dxmaFree(memoryAllocator_, before);
+  dxmaCloseJournal(memoryAllocator_);
+
+  std::ifstream file(path, std::ios::binary);
+  std::string contents((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+  file.close();
+  std::remove(path);
+
+  // The free is recorded, but only the allocation made after opening is live
+  const DxmaJournalHeader* header =
+      reinterpret_cast<const DxmaJournalHeader*>(contents.data());
+  ASSERT_EQ(header->next_sequence.load(), 3);
+  ASSERT_EQ(header->live_allocations, 1);
+  ASSERT_EQ(header->live_bytes[D3D12_HEAP_TYPE_DEFAULT], 4096);
+
+  dxmaFree(memoryAllocator_, after);
+}
+
+// Test case: Publish statistics to shared memory for an external monitor
+TEST_F(DirectXMemoryAllocatorTest, PublishSharedStats) {
+  const char* path = "dxma_stats_test.bin";
+  ASSERT_TRUE(SUCCEEDED(dxmaOpenSharedStats(memoryAllocator_, path)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 1024;                    // 1 KB
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;  // CPU-accessible heap
+
+  DxmaAllocation allocation1 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation1);
+  DxmaAllocation allocation2 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation2);
+  dxmaFree(memoryAllocator_, allocation1);
+  dxmaPublishStats(memoryAllocator_, 1 << 30);
+
+  // Read the region the way an external monitor would
+  std::ifstream file(path, std::ios::binary);
+  std::string contents((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+  file.close();
+  ASSERT_EQ(contents.size(), sizeof(DxmaSharedStatsRegion));
+
+  DxmaSharedStats stats{};
+  ASSERT_TRUE(dxmaReadSharedStats(
+      reinterpret_cast<const DxmaSharedStatsRegion*>(contents.data()),
+      &stats));
+  ASSERT_EQ(stats.budget_bytes, 1 << 30);
+  ASSERT_EQ(stats.heap_count, 1);
+  ASSERT_EQ(stats.allocation_count, 1);
+
+  const DxmaSharedTypeStats& upload = stats.types[D3D12_HEAP_TYPE_UPLOAD];
+  ASSERT_EQ(upload.allocation_count, 1);
+  ASSERT_EQ(upload.allocation_bytes, 1024);
+  ASSERT_EQ(upload.free_block_count, 2);
+  ASSERT_GT(upload.fragmentation, 0.0);
+  ASSERT_LT(upload.fragmentation, 1.0);
+  ASSERT_EQ(stats.types[D3D12_HEAP_TYPE_DEFAULT].heap_count, 0);
+
+  // A region left in the middle of a publish is not read forever
+  DxmaSharedStatsRegion* region =
+      reinterpret_cast<DxmaSharedStatsRegion*>(contents.data());
+  region->sequence.store(region->sequence.load() + 1);
+  ASSERT_FALSE(dxmaReadSharedStats(region, &stats));
+
+  dxmaCloseSharedStats(memoryAllocator_);
+  std::remove(path);
+  dxmaFree(memoryAllocator_, allocation2);
+}
+
+// Test case: Track high-water marks and per-frame deltas
+TEST_F(DirectXMemoryAllocatorTest, TrackPeaksAndFrameDeltas) {
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 1024;                     // 1 KB
+  allocationInfo.type = D3D12_HEAP_TYPE_DEFAULT;  // GPU-only heap
+  allocationInfo.tag = 2;
+
+  dxmaBeginFrame(memoryAllocator_, 1);
+  DxmaAllocation allocation1 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation1);
+  DxmaAllocation allocation2 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation2);
+
+  DxmaFrameStats frameStats{};
+  dxmaEndFrame(memoryAllocator_, &frameStats);
+  ASSERT_EQ(frameStats.frame_index, 1);
+  ASSERT_EQ(frameStats.allocation_count, 2);
+  ASSERT_EQ(frameStats.allocated_bytes, 2048);
+  ASSERT_EQ(frameStats.free_count, 0);
+  ASSERT_EQ(frameStats.create_heap_count, 1);
+
+  // The second frame reuses the heap
+  dxmaBeginFrame(memoryAllocator_, 2);
+  dxmaFree(memoryAllocator_, allocation1);
+  dxmaEndFrame(memoryAllocator_, &frameStats);
+  ASSERT_EQ(frameStats.frame_index, 2);
+  ASSERT_EQ(frameStats.allocation_count, 0);
+  ASSERT_EQ(frameStats.free_count, 1);
+  ASSERT_EQ(frameStats.freed_bytes, 1024);
+  ASSERT_EQ(frameStats.create_heap_count, 0);
+
+  DxmaHeapTypeStats typeStats{};
+  dxmaGetHeapTypeStats(memoryAllocator_, D3D12_HEAP_TYPE_DEFAULT, &typeStats);
+  ASSERT_EQ(typeStats.heap_count, 1);
+  ASSERT_EQ(typeStats.peak_heap_count, 1);
+  ASSERT_EQ(typeStats.allocation_count, 1);
+  ASSERT_EQ(typeStats.peak_allocation_count, 2);
+  ASSERT_EQ(typeStats.allocation_bytes, 1024);
+  ASSERT_EQ(typeStats.peak_allocation_bytes, 2048);
+
+  DxmaTagStats tagStats{};
+  dxmaGetTagStats(memoryAllocator_, 2, &tagStats);
+  ASSERT_EQ(tagStats.peak_count, 2);
+
+  // Peaks restart from the current values
+  dxmaResetPeakStats(memoryAllocator_);
+  dxmaGetHeapTypeStats(memoryAllocator_, D3D12_HEAP_TYPE_DEFAULT, &typeStats);
+  ASSERT_EQ(typeStats.peak_allocation_bytes, 1024);
+  dxmaGetTagStats(memoryAllocator_, 2, &tagStats);
+  ASSERT_EQ(tagStats.peak_bytes, 1024);
+
+  dxmaFree(memoryAllocator_, allocation2);
+}
+
+// Test case: Compose an allocator from best fit and mutex policies
+TEST_F(DirectXMemoryAllocatorTest, BestFitAllocatorWithPolicies) {
+  using BestFitAllocator =
+      dxma_detail::BasicAllocator<dxma_detail::BestFit, dxma_detail::MutexLock,
+                                  dxma_detail::NoTracking,
+                                  dxma_detail::NoStats>;
+  BestFitAllocator allocator(d3dDevice_.Get());
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.type = D3D12_HEAP_TYPE_DEFAULT;  // GPU-only heap
+
+  // Leave a 1 KB hole followed by a 512 byte hole
+  DxmaAllocation allocations[4]{};
+  const UINT64 sizes[4] = {1024, 256, 512, 256};
+  for (int i = 0; i < 4; i++) {
+    allocationInfo.size = sizes[i];
+    allocator.Allocate(allocationInfo, &allocations[i], __FILE__, __LINE__);
+    ASSERT_NE(allocations[i], nullptr);
+  }
+  allocator.Free(allocations[0], nullptr);
+  allocator.Free(allocations[2], nullptr);
+
+  // The smaller hole is used although the larger one comes first
+  DxmaAllocation allocation = nullptr;
+  allocationInfo.size = 512;
+  allocator.Allocate(allocationInfo, &allocation, __FILE__, __LINE__);
+  ASSERT_EQ(allocation->GetOffset(), 1280);
+
+  // No statistics are kept
+  ASSERT_EQ(allocator.GetTagStats(0).live_count, 0);
+
+  allocator.Free(allocation, nullptr);
+  allocator.Free(allocations[1], nullptr);
+  allocator.Free(allocations[3], nullptr);
+  ASSERT_EQ(allocator.GetFreeBlockCount(), 1);
+}
+
+// Test case: Configure an allocator through DxmaAllocatorDesc
+TEST_F(DirectXMemoryAllocatorTest, CreateAllocatorFromDesc) {
+  struct HeapEvents {
+    UINT32 created = 0;
+    UINT32 released = 0;
+    UINT64 created_bytes = 0;
+  } heapEvents;
+
+  DxmaAllocatorDesc desc{};
+  desc.device = d3dDevice_.Get();
+  desc.preferred_heap_size[D3D12_HEAP_TYPE_UPLOAD] = 1 << 20;  // 1 MB
+  desc.max_heap_count = 4;
+  desc.strategy = DXMA_ALLOCATION_STRATEGY_BEST_FIT;
+  desc.on_create_heap = [](ID3D12Heap*, D3D12_HEAP_TYPE, UINT64 size, UINT32,
+                           void* user_data) {
+    HeapEvents* events = static_cast<HeapEvents*>(user_data);
+    events->created++;
+    events->created_bytes += size;
+  };
+  desc.on_release_heap = [](ID3D12Heap*, D3D12_HEAP_TYPE, UINT64, UINT32,
+                            void* user_data) {
+    static_cast<HeapEvents*>(user_data)->released++;
+  };
+  desc.callback_user_data = &heapEvents;
+
+  DxmaAllocator allocator = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateAllocator(&allocator, desc)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 1024;                    // 1 KB
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;  // CPU-accessible heap
+
+  DxmaAllocation allocation = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &allocation);
+  ASSERT_NE(allocation, nullptr);
+  ASSERT_EQ(heapEvents.created, 1);
+  ASSERT_EQ(heapEvents.created_bytes, 1 << 20);
+  ASSERT_EQ(allocation->GetHeap()->GetDesc().SizeInBytes, 1 << 20);
+
+  // Other heap types keep the default size
+  DxmaAllocation defaultAllocation = nullptr;
+  allocationInfo.type = D3D12_HEAP_TYPE_DEFAULT;
+  dxmaAllocate(allocator, allocationInfo, &defaultAllocation);
+  ASSERT_EQ(defaultAllocation->GetHeap()->GetDesc().SizeInBytes,
+            DXMA_HEAP_BLOCK_SIZE);
+
+  dxmaFree(allocator, allocation);
+  dxmaFree(allocator, defaultAllocation);
+  dxmaDestroyAllocator(allocator);
+  ASSERT_EQ(heapEvents.released, 2);
+
+  // A device is required
+  ASSERT_FALSE(SUCCEEDED(dxmaCreateAllocator(&allocator, DxmaAllocatorDesc{})));
+}
+
+// Test case: Grow heaps geometrically and release empty ones
+TEST_F(DirectXMemoryAllocatorTest, GrowHeapsGeometricallyAndTrim) {
+  DxmaAllocatorDesc desc{};
+  desc.device = d3dDevice_.Get();
+  desc.growth_policy = DXMA_GROWTH_POLICY_GEOMETRIC;
+  desc.min_heap_size = 4 << 20;                                 // 4 MB
+  desc.preferred_heap_size[D3D12_HEAP_TYPE_DEFAULT] = 8 << 20;  // 8 MB cap
+
+  DxmaAllocator allocator = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateAllocator(&allocator, desc)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 64 * 1024;                // 64 KB
+  allocationInfo.type = D3D12_HEAP_TYPE_DEFAULT;  // GPU-only heap
+
+  // 4 MB, 4 MB, 8 MB and then the 8 MB cap
+  std::vector<DxmaAllocation> allocations(64 + 64 + 128 + 1);
+  for (DxmaAllocation& allocation : allocations) {
+    dxmaAllocate(allocator, allocationInfo, &allocation);
+    ASSERT_NE(allocation, nullptr);
+  }
+  ASSERT_EQ(allocations[0]->GetHeap()->GetDesc().SizeInBytes, 4 << 20);
+  ASSERT_EQ(allocations[64]->GetHeap()->GetDesc().SizeInBytes, 4 << 20);
+  ASSERT_EQ(allocations[128]->GetHeap()->GetDesc().SizeInBytes, 8 << 20);
+  ASSERT_EQ(allocations[256]->GetHeap()->GetDesc().SizeInBytes, 8 << 20);
+
+  // Heaps in use are never released
+  ASSERT_EQ(dxmaTrim(allocator), 0);
+
+  for (DxmaAllocation allocation : allocations) {
+    dxmaFree(allocator, allocation);
+  }
+
+  // The small heaps are released first
+  DxmaHeapTypeStats typeStats{};
+  ASSERT_EQ(dxmaTrim(allocator, 8 << 20), 2);
+  dxmaGetHeapTypeStats(allocator, D3D12_HEAP_TYPE_DEFAULT, &typeStats);
+  ASSERT_EQ(typeStats.heap_count, 2);
+  ASSERT_EQ(typeStats.heap_bytes, 16 << 20);
+
+  ASSERT_EQ(dxmaTrim(allocator), 2);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 0);
+  ASSERT_EQ(allocator->GetHeapCount(), 0);
+
+  // Growth starts over once the memory of the type was released
+  DxmaAllocation allocation = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &allocation);
+  ASSERT_EQ(allocation->GetHeapIndex(), 0);
+  ASSERT_EQ(allocation->GetHeap()->GetDesc().SizeInBytes, 4 << 20);
+
+  // Large requests bias the heap size upwards
+  allocationInfo.size = 1 << 20;  // 1 MB
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+  DxmaAllocation largeAllocation = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &largeAllocation);
+  ASSERT_EQ(largeAllocation->GetHeap()->GetDesc().SizeInBytes, 16 << 20);
+
+  dxmaFree(allocator, allocation);
+  dxmaFree(allocator, largeAllocation);
+  dxmaDestroyAllocator(allocator);
+}
+
+// Test case: Allocate offsets from a virtual block
+TEST_F(DirectXMemoryAllocatorTest, AllocateFromVirtualBlock) {
+  DxmaVirtualBlock block = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateVirtualBlock(&block, 4096)));
+
+  UINT64 offset1 = 0;
+  UINT64 offset2 = 0;
+  UINT64 offset3 = 0;
+  ASSERT_TRUE(SUCCEEDED(dxmaVirtualAllocate(block, 100, 0, &offset1)));
+  ASSERT_TRUE(SUCCEEDED(dxmaVirtualAllocate(block, 256, 256, &offset2)));
+  ASSERT_TRUE(SUCCEEDED(dxmaVirtualAllocate(block, 64, 0, &offset3)));
+  ASSERT_EQ(offset1, 0);
+  ASSERT_EQ(offset2, 256);
+
+  // The alignment padding is used by later allocations
+  ASSERT_EQ(offset3, 100);
+
+  DxmaVirtualBlockStats stats{};
+  dxmaGetVirtualBlockStats(block, &stats);
+  ASSERT_EQ(stats.allocation_count, 3);
+  ASSERT_EQ(stats.allocated_bytes, 420);
+  ASSERT_EQ(stats.free_block_count, 2);
+  ASSERT_EQ(stats.free_bytes, 4096 - 420);
+  ASSERT_EQ(stats.largest_free_block, 4096 - 512);
+
+  // Requests larger than the largest free range fail
+  UINT64 offset = 0;
+  ASSERT_EQ(dxmaVirtualAllocate(block, 4096, 0, &offset), E_OUTOFMEMORY);
+
+  // Freed ranges are merged with their neighbours
+  dxmaVirtualFree(block, offset2);
+  dxmaVirtualFree(block, offset1);
+  dxmaVirtualFree(block, offset3);
+  dxmaGetVirtualBlockStats(block, &stats);
+  ASSERT_EQ(stats.allocation_count, 0);
+  ASSERT_EQ(stats.free_block_count, 1);
+  ASSERT_EQ(stats.largest_free_block, 4096);
+
+  ASSERT_TRUE(SUCCEEDED(dxmaVirtualAllocate(block, 4096, 0, &offset)));
+  dxmaClearVirtualBlock(block);
+  dxmaGetVirtualBlockStats(block, &stats);
+  ASSERT_EQ(stats.free_bytes, 4096);
+
+  dxmaDestroyVirtualBlock(block);
+}
+
+// Test case: Sub-allocate from a range reserved as a block
+TEST_F(DirectXMemoryAllocatorTest, SubAllocateFromBlock) {
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 256;
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+
+  // Occupy the start of the heap so the block does not begin at zero
+  DxmaAllocation allocation = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation);
+
+  allocationInfo.size = 64 * 1024;  // 64 KB
+  DxmaBlock block = nullptr;
+  ASSERT_TRUE(
+      SUCCEEDED(dxmaAllocateBlock(memoryAllocator_, allocationInfo, &block)));
+  DxmaAllocation range = block->GetRange();
+  ASSERT_EQ(range->GetOffset(), 256);
+
+  DxmaBlockAllocation sub1{};
+  DxmaBlockAllocation sub2{};
+  ASSERT_TRUE(SUCCEEDED(dxmaBlockAllocate(block, 100, 0, &sub1)));
+  ASSERT_TRUE(SUCCEEDED(dxmaBlockAllocate(block, 512, 256, &sub2)));
+  ASSERT_EQ(sub1.heap, range->GetHeap());
+  ASSERT_EQ(sub1.offset, range->GetOffset());
+  ASSERT_EQ(sub2.heap, range->GetHeap());
+  ASSERT_EQ(sub2.offset, range->GetOffset() + 256);
+
+  // Alignments apply to heap offsets, not to offsets within the block
+  DxmaBlockAllocation aligned{};
+  ASSERT_TRUE(SUCCEEDED(dxmaBlockAllocate(block, 100, 4096, &aligned)));
+  ASSERT_EQ(aligned.offset, 4096);
+  dxmaBlockFree(block, aligned);
+
+  // Requests larger than the block fail without touching the allocator
+  DxmaBlockAllocation sub3{};
+  ASSERT_EQ(dxmaBlockAllocate(block, 64 * 1024, 0, &sub3), E_OUTOFMEMORY);
+  ASSERT_EQ(memoryAllocator_->GetFreeBlockCount(), 1);
+
+  DxmaVirtualBlockStats stats{};
+  dxmaGetBlockStats(block, &stats);
+  ASSERT_EQ(stats.size, 64 * 1024);
+  ASSERT_EQ(stats.allocation_count, 2);
+  ASSERT_EQ(stats.allocated_bytes, 612);
+
+  dxmaBlockFree(block, sub1);
+  dxmaBlockFree(block, sub2);
+  dxmaGetBlockStats(block, &stats);
+  ASSERT_EQ(stats.free_block_count, 1);
+
+  // The whole range returns to the allocator with the block
+  dxmaDestroyBlock(memoryAllocator_, block);
+  dxmaFree(memoryAllocator_, allocation, nullptr);
+  ASSERT_EQ(memoryAllocator_->GetFreeBlockCount(), 1);
+}
+
+// Test case: Place allocations by their expected lifetime
+TEST_F(DirectXMemoryAllocatorTest, PlaceAllocationsByLifetime) {
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 256;
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+
+  DxmaAllocation permanent = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &permanent);
+  ASSERT_EQ(permanent->GetOffset(), 0);
+
+  // Transient allocations are placed from the top of the same heap
+  allocationInfo.lifetime = DXMA_LIFETIME_TRANSIENT;
+  DxmaAllocation transient1 = nullptr;
+  DxmaAllocation transient2 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &transient1);
+  dxmaAllocate(memoryAllocator_, allocationInfo, &transient2);
+  UINT64 heapSize = permanent->GetHeap()->GetDesc().SizeInBytes;
+  ASSERT_EQ(transient1->GetHeap(), permanent->GetHeap());
+  ASSERT_EQ(transient1->GetOffset(), heapSize - 256);
+  ASSERT_EQ(transient2->GetOffset(), heapSize - 512);
+
+  // Permanent allocations keep growing from the bottom
+  allocationInfo.lifetime = DXMA_LIFETIME_PERMANENT;
+  DxmaAllocation permanent2 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &permanent2);
+  ASSERT_EQ(permanent2->GetOffset(), 256);
+
+  // Level allocations get heaps of their own
+  allocationInfo.lifetime = DXMA_LIFETIME_LEVEL;
+  DxmaAllocation level = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &level);
+  ASSERT_NE(level->GetHeap(), permanent->GetHeap());
+  ASSERT_EQ(level->GetOffset(), 0);
+
+  dxmaFree(memoryAllocator_, transient1, nullptr);
+  dxmaFree(memoryAllocator_, transient2, nullptr);
+  dxmaFree(memoryAllocator_, permanent, nullptr);
+  dxmaFree(memoryAllocator_, permanent2, nullptr);
+  dxmaFree(memoryAllocator_, level, nullptr);
+  ASSERT_EQ(memoryAllocator_->GetFreeBlockCount(), 2);
+}
+
+// Test case: Prefer the fullest heap that has room for an allocation
+TEST_F(DirectXMemoryAllocatorTest, PreferFullerHeaps) {
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 256;
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+
+  DxmaAllocation small = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &small);
+  UINT64 heapSize = small->GetHeap()->GetDesc().SizeInBytes;
+
+  // Leave only 128 bytes in a second heap
+  allocationInfo.size = heapSize - 128;
+  DxmaAllocation large = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &large);
+  ASSERT_NE(large->GetHeap(), small->GetHeap());
+
+  // The second heap is fuller, so it is used although it comes later
+  allocationInfo.size = 64;
+  DxmaAllocation allocation1 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation1);
+  ASSERT_EQ(allocation1->GetHeap(), large->GetHeap());
+  ASSERT_EQ(allocation1->GetOffset(), heapSize - 128);
+
+  // Once it drains, the first heap is the fuller one
+  dxmaFree(memoryAllocator_, large, nullptr);
+  DxmaAllocation allocation2 = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &allocation2);
+  ASSERT_EQ(allocation2->GetHeap(), small->GetHeap());
+
+  dxmaFree(memoryAllocator_, allocation1, nullptr);
+  dxmaFree(memoryAllocator_, allocation2, nullptr);
+  dxmaFree(memoryAllocator_, small, nullptr);
+  ASSERT_EQ(memoryAllocator_->GetFreeBlockCount(), 2);
+}
+
+// Test case: Compare heaps of different sizes by the share that is free
+TEST_F(DirectXMemoryAllocatorTest, PreferFullerHeapsOfUnequalSizes) {
+  const UINT64 megabyte = 1024 * 1024;
+  DxmaAllocatorDesc desc{};
+  desc.device = d3dDevice_.Get();
+  desc.preferred_heap_size[D3D12_HEAP_TYPE_UPLOAD] = megabyte;
+
+  DxmaAllocator allocator = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateAllocator(&allocator, desc)));
+
+  // A 1 MB heap with 768 KB free and a 12 MB heap with 1 MB free
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+  allocationInfo.size = megabyte / 4;
+  DxmaAllocation sparse = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &sparse);
+  allocationInfo.size = 3 * megabyte;
+  DxmaAllocation busy1 = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &busy1);
+  allocationInfo.size = 8 * megabyte;
+  DxmaAllocation busy2 = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &busy2);
+  ASSERT_EQ(busy1->GetHeap()->GetDesc().SizeInBytes, 12 * megabyte);
+  ASSERT_EQ(busy2->GetHeap(), busy1->GetHeap());
+
+  // The larger heap has more free bytes but is the fuller one
+  allocationInfo.size = megabyte / 4;
+  DxmaAllocation allocation = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &allocation);
+  ASSERT_EQ(allocation->GetHeap(), busy1->GetHeap());
+
+  dxmaFree(allocator, allocation, nullptr);
+  dxmaFree(allocator, busy2, nullptr);
+  dxmaFree(allocator, busy1, nullptr);
+  dxmaFree(allocator, sparse, nullptr);
+  dxmaDestroyAllocator(allocator);
+}
+
+// Test case: Skip heaps whose largest free block is too small
+TEST_F(DirectXMemoryAllocatorTest, SkipHeapsByLargestFreeBlock) {
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+  allocationInfo.size = 1024;
+
+  DxmaAllocation first = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &first);
+  UINT64 heapSize = first->GetHeap()->GetDesc().SizeInBytes;
+  UINT32 heapIndex = first->GetHeapIndex();
+  const dxma_detail::FreeList& freeList =
+      memoryAllocator_->GetFreeLists()[heapIndex];
+
+  // Leave 1 KB at the end of the heap and split it
+  allocationInfo.size = heapSize - 2048;
+  DxmaAllocation large = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &large);
+  allocationInfo.size = 256;
+  DxmaAllocation small = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &small);
+  ASSERT_EQ(small->GetHeap(), first->GetHeap());
+  ASSERT_EQ(freeList.GetLargestFreeBlock(), 768);
+
+  // A request larger than every free block goes to a new heap
+  allocationInfo.size = 1024;
+  DxmaAllocation other = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &other);
+  ASSERT_NE(other->GetHeap(), first->GetHeap());
+
+  // Merged blocks update the summary
+  dxmaFree(memoryAllocator_, small, nullptr);
+  ASSERT_EQ(freeList.GetLargestFreeBlock(), 1024);
+  dxmaFree(memoryAllocator_, first, nullptr);
+  ASSERT_EQ(freeList.GetLargestFreeBlock(), 1024);
+  dxmaFree(memoryAllocator_, large, nullptr);
+  ASSERT_EQ(freeList.GetLargestFreeBlock(), heapSize);
+
+  // Heaps are removed from the index when they are trimmed
+  dxmaFree(memoryAllocator_, other, nullptr);
+  ASSERT_EQ(dxmaTrim(memoryAllocator_), 2);
+  DxmaAllocation again = nullptr;
+  dxmaAllocate(memoryAllocator_, allocationInfo, &again);
+  ASSERT_NE(again, nullptr);
+  dxmaFree(memoryAllocator_, again, nullptr);
+}
+
+// Test case: Track heaps of a paged type as bitmaps of 64 KB pages
+TEST_F(DirectXMemoryAllocatorTest, AllocatePagesFromBitmapHeaps) {
+  const UINT64 page = 64 * 1024;
+  DxmaAllocatorDesc desc{};
+  desc.device = d3dDevice_.Get();
+  desc.preferred_heap_size[D3D12_HEAP_TYPE_DEFAULT] = 16 * page;
+  desc.page_size[D3D12_HEAP_TYPE_DEFAULT] = page;
+
+  DxmaAllocator allocator = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateAllocator(&allocator, desc)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.type = D3D12_HEAP_TYPE_DEFAULT;
+
+  // Allocations are rounded up to whole pages
+  allocationInfo.size = 1000;
+  DxmaAllocation small = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &small);
+  allocationInfo.size = 100 * 1024;
+  DxmaAllocation twoPages = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &twoPages);
+  ASSERT_EQ(small->GetOffset(), 0);
+  ASSERT_EQ(twoPages->GetOffset(), page);
+
+  // Transient allocations take the last pages
+  allocationInfo.size = page;
+  allocationInfo.lifetime = DXMA_LIFETIME_TRANSIENT;
+  DxmaAllocation transient = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &transient);
+  ASSERT_EQ(transient->GetOffset(), 15 * page);
+
+  // Alignments above the page size skip unaligned pages, the size is
+  // rounded up to the alignment
+  allocationInfo.lifetime = DXMA_LIFETIME_PERMANENT;
+  allocationInfo.alignment = 4 * page;
+  DxmaAllocation aligned = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &aligned);
+  ASSERT_EQ(aligned->GetOffset(), 4 * page);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 2);
+
+  // Freed pages merge with free neighbours
+  dxmaFree(allocator, twoPages, nullptr);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 2);
+  ASSERT_EQ(allocator->GetHeapLargestFreeBlock(small->GetHeapIndex()),
+            7 * page);
+
+  // A run longer than any free run goes to a new heap
+  allocationInfo.alignment = 0;
+  allocationInfo.size = 11 * page;
+  DxmaAllocation large = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &large);
+  ASSERT_NE(large->GetHeap(), small->GetHeap());
+
+  dxmaFree(allocator, small, nullptr);
+  dxmaFree(allocator, transient, nullptr);
+  dxmaFree(allocator, aligned, nullptr);
+  dxmaFree(allocator, large, nullptr);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 2);
+  ASSERT_EQ(dxmaTrim(allocator), 2);
+
+  dxmaDestroyAllocator(allocator);
+}
+
+// Test case: Best fit over the flat size array of a free list
+TEST_F(DirectXMemoryAllocatorTest, BestFitOverFlatSizeArray) {
+  dxma_detail::BasicVirtualBlock<dxma_detail::BestFit> block(1 << 20);
+
+  // Free every other range, leaving 20 free blocks of different sizes
+  std::vector<UINT64> offsets;
+  std::vector<UINT64> sizes;
+  for (UINT64 i = 0; i < 41; i++) {
+    UINT64 size = 64 * (i * 5 % 7 + 1);
+    UINT64 offset = 0;
+    ASSERT_TRUE(block.Allocate(size, 0, &offset));
+    offsets.push_back(offset);
+    sizes.push_back(size);
+  }
+  for (size_t i = 0; i < 40; i += 2) block.Free(offsets[i]);
+  ASSERT_EQ(block.GetFreeList().GetBlockCount(), 21);
+
+  // Expect the smallest block that fits, the lowest one among equal sizes
+  auto expected = [&](UINT64 size) {
+    size_t best = 40;
+    for (size_t i = 0; i < 40; i += 2) {
+      if (sizes[i] >= size && (best == 40 || sizes[i] < sizes[best])) {
+        best = i;
+      }
+    }
+    return offsets[best];
+  };
+
+  for (UINT64 size : {64, 100, 193, 320, 448}) {
+    UINT64 offset = 0;
+    UINT64 want = expected(size);
+    ASSERT_TRUE(block.Allocate(size, 0, &offset));
+    ASSERT_EQ(offset, want);
+    block.Free(offset);
+  }
+
+  // Requests larger than every block between allocations use the tail
+  UINT64 offset = 0;
+  ASSERT_TRUE(block.Allocate(1024, 0, &offset));
+  ASSERT_GT(offset, offsets.back());
+}
+
+// Test case: Reuse freed ranges of the same size from quick lists
+TEST_F(DirectXMemoryAllocatorTest, ReuseRangesFromQuickLists) {
+  const UINT64 range = 64 * 1024;
+  DxmaAllocatorDesc desc{};
+  desc.device = d3dDevice_.Get();
+  desc.preferred_heap_size[D3D12_HEAP_TYPE_UPLOAD] = 16 * range;
+  desc.quick_list_depth = 4;
+  desc.quick_list_max_size = range;
+
+  DxmaAllocator allocator = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateAllocator(&allocator, desc)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = range;
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+
+  DxmaAllocation allocations[3] = {};
+  for (DxmaAllocation& allocation : allocations) {
+    dxmaAllocate(allocator, allocationInfo, &allocation);
+  }
+
+  // A freed range is kept without coalescing and served to the next
+  // allocation of its size
+  dxmaFree(allocator, allocations[1], nullptr);
+  ASSERT_EQ(allocator->GetQuickListBytes(), range);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 1);
+  dxmaAllocate(allocator, allocationInfo, &allocations[1]);
+  ASSERT_EQ(allocations[1]->GetOffset(), range);
+  ASSERT_EQ(allocator->GetQuickListBytes(), 0);
+
+  // Larger ranges are returned to the heap at once
+  allocationInfo.size = 2 * range;
+  DxmaAllocation large = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &large);
+  dxmaFree(allocator, large, nullptr);
+  ASSERT_EQ(allocator->GetQuickListBytes(), 0);
+
+  // Quick lists are coalesced before a new heap would be created
+  dxmaFree(allocator, allocations[1], nullptr);
+  dxmaFree(allocator, allocations[2], nullptr);
+  ASSERT_EQ(allocator->GetQuickListBytes(), 2 * range);
+  allocationInfo.size = 14 * range;
+  DxmaAllocation fill = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &fill);
+  ASSERT_EQ(fill->GetHeap(), allocations[0]->GetHeap());
+  ASSERT_EQ(fill->GetOffset(), range);
+  ASSERT_EQ(allocator->GetQuickListBytes(), 0);
+
+  dxmaFree(allocator, fill, nullptr);
+  dxmaFree(allocator, allocations[0], nullptr);
+  ASSERT_EQ(dxmaFlushQuickLists(allocator), 1);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 1);
+
+  // Transient allocations do not reuse ranges placed for permanent ones
+  allocationInfo.size = range;
+  DxmaAllocation permanent = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &permanent);
+  dxmaFree(allocator, permanent, nullptr);
+  allocationInfo.lifetime = DXMA_LIFETIME_TRANSIENT;
+  DxmaAllocation transient = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &transient);
+  ASSERT_EQ(transient->GetOffset(), 15 * range);
+  ASSERT_EQ(allocator->GetQuickListBytes(), range);
+  dxmaFree(allocator, transient, nullptr);
+  ASSERT_EQ(dxmaFlushQuickLists(allocator), 2);
+
+  dxmaDestroyAllocator(allocator);
+}
+
+// Test case: Coalesce pending frees before creating a heap when no free
+// block is aligned for a request
+TEST_F(DirectXMemoryAllocatorTest, MergePendingFreesForAlignedRequests) {
+  const UINT64 range = 64 * 1024;
+  DxmaAllocatorDesc desc{};
+  desc.device = d3dDevice_.Get();
+  desc.preferred_heap_size[D3D12_HEAP_TYPE_UPLOAD] = 16 * range;
+  desc.pending_free_limit = 8;
+
+  DxmaAllocator allocator = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateAllocator(&allocator, desc)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+  const UINT64 sizes[5] = {range, 4 * range, 3 * range, 4 * range,
+                           4 * range};
+  DxmaAllocation allocations[5] = {};
+  for (int i = 0; i < 5; i++) {
+    allocationInfo.size = sizes[i];
+    dxmaAllocate(allocator, allocationInfo, &allocations[i]);
+  }
+  ASSERT_EQ(allocations[3]->GetOffset(), 8 * range);
+
+  // The only free block is large enough but not aligned, and the aligned
+  // range is still pending
+  dxmaFree(allocator, allocations[1], nullptr);
+  ASSERT_EQ(dxmaCoalesce(allocator), 1);
+  dxmaFree(allocator, allocations[3], nullptr);
+  ASSERT_EQ(allocator->GetPendingFreeBytes(), 4 * range);
+
+  allocationInfo.size = 4 * range;
+  allocationInfo.alignment = 4 * range;
+  DxmaAllocation aligned = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &aligned);
+  ASSERT_EQ(aligned->GetOffset(), 8 * range);
+  ASSERT_EQ(allocator->GetPendingFreeBytes(), 0);
+  DxmaHeapTypeStats stats{};
+  dxmaGetHeapTypeStats(allocator, D3D12_HEAP_TYPE_UPLOAD, &stats);
+  ASSERT_EQ(stats.heap_count, 1);
+
+  dxmaFree(allocator, aligned, nullptr);
+  dxmaFree(allocator, allocations[0], nullptr);
+  dxmaFree(allocator, allocations[2], nullptr);
+  dxmaFree(allocator, allocations[4], nullptr);
+  dxmaDestroyAllocator(allocator);
+}
+
+// Test case: Collect frees and merge them in one sorted sweep
+TEST_F(DirectXMemoryAllocatorTest, MergePendingFreesInBatches) {
+  DxmaAllocatorDesc desc{};
+  desc.device = d3dDevice_.Get();
+  desc.pending_free_limit = 8;
+
+  DxmaAllocator allocator = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateAllocator(&allocator, desc)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = 1024;
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+
+  DxmaAllocation allocations[10] = {};
+  for (DxmaAllocation& allocation : allocations) {
+    dxmaAllocate(allocator, allocationInfo, &allocation);
+  }
+
+  // Frees are only collected until the limit is reached
+  for (int i = 6; i >= 0; i--) dxmaFree(allocator, allocations[i], nullptr);
+  ASSERT_EQ(allocator->GetPendingFreeBytes(), 7 * 1024);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 1);
+
+  dxmaFree(allocator, allocations[8], nullptr);
+  ASSERT_EQ(allocator->GetPendingFreeBytes(), 0);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 3);
+
+  // Pending frees are merged on request
+  dxmaFree(allocator, allocations[7], nullptr);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 3);
+  ASSERT_EQ(dxmaCoalesce(allocator), 1);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 2);
+
+  dxmaFree(allocator, allocations[9], nullptr);
+  ASSERT_EQ(dxmaCoalesce(allocator), 1);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 1);
+
+  // Only the heaps an allocation searches are coalesced before a new heap
+  allocationInfo.type = D3D12_HEAP_TYPE_DEFAULT;
+  DxmaAllocation other = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &other);
+  dxmaFree(allocator, other, nullptr);
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+  allocationInfo.size = DXMA_HEAP_BLOCK_SIZE;
+  DxmaAllocation large = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &large);
+  ASSERT_EQ(allocator->GetPendingFreeBytes(), 1024);
+  dxmaFree(allocator, large, nullptr);
+  ASSERT_EQ(dxmaCoalesce(allocator), 2);
+
+  dxmaDestroyAllocator(allocator);
+}
+
+// Test case: Do deferred maintenance in dxmaIdle
+TEST_F(DirectXMemoryAllocatorTest, DoDeferredWorkWhenIdle) {
+  const UINT64 range = 64 * 1024;
+  DxmaAllocatorDesc desc{};
+  desc.device = d3dDevice_.Get();
+  desc.preferred_heap_size[D3D12_HEAP_TYPE_UPLOAD] = 16 * range;
+  desc.quick_list_depth = 4;
+  desc.quick_list_max_size = range;
+  desc.pending_free_limit = 8;
+
+  DxmaAllocator allocator = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateAllocator(&allocator, desc)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = range;
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+  DxmaAllocation small = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &small);
+
+  // Only a size whose quick list ran out counts as a miss
+  dxmaFree(allocator, small, nullptr);
+  dxmaAllocate(allocator, allocationInfo, &small);
+  DxmaAllocation other = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &other);
+  ASSERT_EQ(other->GetOffset(), range);
+
+  allocationInfo.size = 2 * range;
+  DxmaAllocation large = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &large);
+  dxmaFree(allocator, large, nullptr);
+
+  // Nothing is done without a budget
+  ASSERT_FALSE(dxmaIdle(allocator, 0));
+  ASSERT_EQ(allocator->GetPendingFreeBytes(), 2 * range);
+
+  // Pending frees are merged and a range is pre-split for the size that
+  // missed the quick lists
+  ASSERT_TRUE(dxmaIdle(allocator, 1000000));
+  ASSERT_EQ(allocator->GetPendingFreeBytes(), 0);
+  ASSERT_EQ(allocator->GetQuickListBytes(), range);
+  allocationInfo.size = range;
+  DxmaAllocation reused = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &reused);
+  ASSERT_EQ(reused->GetOffset(), 2 * range);
+  ASSERT_EQ(allocator->GetQuickListBytes(), 0);
+
+  // Empty heaps are kept while the peak allocation size needs them
+  dxmaFree(allocator, small, nullptr);
+  dxmaFree(allocator, other, nullptr);
+  dxmaFree(allocator, reused, nullptr);
+  ASSERT_TRUE(dxmaIdle(allocator, 1000000));
+  ASSERT_TRUE(dxmaIdle(allocator, 1000000));
+  ASSERT_EQ(allocator->GetQuickListBytes(), 0);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 1);
+  DxmaHeapTypeStats stats{};
+  dxmaGetHeapTypeStats(allocator, D3D12_HEAP_TYPE_UPLOAD, &stats);
+  ASSERT_EQ(stats.heap_count, 1);
+
+  dxmaResetPeakStats(allocator);
+  ASSERT_TRUE(dxmaIdle(allocator, 1000000));
+  dxmaGetHeapTypeStats(allocator, D3D12_HEAP_TYPE_UPLOAD, &stats);
+  ASSERT_EQ(stats.heap_count, 0);
+
+  // A heap is created ahead of time after trimming below the peak
+  allocationInfo.size = 4 * range;
+  dxmaAllocate(allocator, allocationInfo, &large);
+  dxmaFree(allocator, large, nullptr);
+  ASSERT_EQ(dxmaTrim(allocator), 1);
+  ASSERT_TRUE(dxmaIdle(allocator, 1000000));
+  dxmaGetHeapTypeStats(allocator, D3D12_HEAP_TYPE_UPLOAD, &stats);
+  ASSERT_EQ(stats.heap_count, 1);
+  ASSERT_EQ(stats.heap_bytes, 16 * range);
+
+  dxmaAllocate(allocator, allocationInfo, &large);
+  dxmaGetHeapTypeStats(allocator, D3D12_HEAP_TYPE_UPLOAD, &stats);
+  ASSERT_EQ(stats.heap_count, 1);
+  dxmaFree(allocator, large, nullptr);
+
+  // A peak larger than a heap is covered with heaps of the preferred size
+  allocationInfo.size = 10 * range;
+  DxmaAllocation peaks[3] = {};
+  for (DxmaAllocation& peak : peaks) {
+    dxmaAllocate(allocator, allocationInfo, &peak);
+  }
+  for (DxmaAllocation& peak : peaks) dxmaFree(allocator, peak, nullptr);
+  ASSERT_EQ(dxmaTrim(allocator), 3);
+  ASSERT_TRUE(dxmaIdle(allocator, 1000000));
+  dxmaGetHeapTypeStats(allocator, D3D12_HEAP_TYPE_UPLOAD, &stats);
+  ASSERT_EQ(stats.heap_count, 2);
+  ASSERT_EQ(stats.heap_bytes, 32 * range);
+
+  dxmaDestroyAllocator(allocator);
+}
+
+// Test case: Grow and shrink allocations in place
+TEST_F(DirectXMemoryAllocatorTest, ResizeInPlace) {
+  const UINT64 range = 64 * 1024;
+  DxmaAllocatorDesc desc{};
+  desc.device = d3dDevice_.Get();
+  desc.preferred_heap_size[D3D12_HEAP_TYPE_UPLOAD] = 16 * range;
+
+  DxmaAllocator allocator = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateAllocator(&allocator, desc)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = range;
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+  DxmaAllocation buffer = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &buffer);
+
+  // Growing takes the front of the free range after the allocation
+  ASSERT_TRUE(dxmaResize(allocator, buffer, 3 * range));
+  ASSERT_EQ(buffer->GetOffset(), 0);
+  ASSERT_EQ(buffer->GetSize(), 3 * range);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 1);
+
+  DxmaAllocation next = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &next);
+  ASSERT_EQ(next->GetOffset(), 3 * range);
+
+  // An allocation that is in the way requires a move
+  ASSERT_FALSE(dxmaResize(allocator, buffer, 4 * range));
+  ASSERT_EQ(buffer->GetSize(), 3 * range);
+
+  // Shrinking returns the tail
+  const char* path = "dxma_resize_journal_test.bin";
+  ASSERT_TRUE(SUCCEEDED(dxmaOpenJournal(allocator, path, 8)));
+  dxmaBeginFrame(allocator, 1);
+  ASSERT_TRUE(dxmaResize(allocator, buffer, range));
+  ASSERT_EQ(buffer->GetSize(), range);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 2);
+  DxmaHeapTypeStats stats{};
+  dxmaGetHeapTypeStats(allocator, D3D12_HEAP_TYPE_UPLOAD, &stats);
+  ASSERT_EQ(stats.allocation_bytes, 2 * range);
+  ASSERT_EQ(stats.peak_allocation_bytes, 4 * range);
+
+  // A resize is one journal record and counts its size change in the frame
+  ASSERT_TRUE(dxmaResize(allocator, buffer, 2 * range));
+  DxmaFrameStats frameStats{};
+  dxmaEndFrame(allocator, &frameStats);
+  ASSERT_EQ(frameStats.resize_count, 2);
+  ASSERT_EQ(frameStats.allocated_bytes, range);
+  ASSERT_EQ(frameStats.freed_bytes, 2 * range);
+  dxmaCloseJournal(allocator);
+
+  std::ifstream file(path, std::ios::binary);
+  std::string contents((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+  file.close();
+  std::remove(path);
+  const DxmaJournalHeader* header =
+      reinterpret_cast<const DxmaJournalHeader*>(contents.data());
+  const DxmaJournalRecord* records =
+      reinterpret_cast<const DxmaJournalRecord*>(
+          reinterpret_cast<const DxmaJournalHeap*>(header + 1) +
+          header->heap_capacity);
+  ASSERT_EQ(header->next_sequence.load(), 3);
+  ASSERT_EQ(records[2].event, DXMA_JOURNAL_EVENT_RESIZE);
+  ASSERT_EQ(records[2].size, 2 * range);
+  dxmaFree(allocator, next, nullptr);
+  dxmaFree(allocator, buffer, nullptr);
+  ASSERT_EQ(allocator->GetFreeBlockCount(), 1);
+
+  dxmaDestroyAllocator(allocator);
+}
+
+// Test case: Resizing rounds the size to the alignment and grows into
+// ranges held in quick lists
+TEST_F(DirectXMemoryAllocatorTest, ResizeIntoQuickListRanges) {
+  const UINT64 range = 64 * 1024;
+  DxmaAllocatorDesc desc{};
+  desc.device = d3dDevice_.Get();
+  desc.preferred_heap_size[D3D12_HEAP_TYPE_UPLOAD] = 16 * range;
+  desc.quick_list_depth = 4;
+  desc.quick_list_max_size = range;
+
+  DxmaAllocator allocator = nullptr;
+  ASSERT_TRUE(SUCCEEDED(dxmaCreateAllocator(&allocator, desc)));
+
+  DxmaAllocationInfo allocationInfo{};
+  allocationInfo.size = range;
+  allocationInfo.alignment = range;
+  allocationInfo.type = D3D12_HEAP_TYPE_UPLOAD;
+  DxmaAllocation buffer = nullptr;
+  DxmaAllocation next = nullptr;
+  DxmaAllocation last = nullptr;
+  dxmaAllocate(allocator, allocationInfo, &buffer);
+  dxmaAllocate(allocator, allocationInfo, &next);
+  dxmaAllocate(allocator, allocationInfo, &last);
+
+  // The freed neighbour is parked in a quick list
+  dxmaFree(allocator, next, nullptr);
+  ASSERT_EQ(allocator->GetQuickListBytes(), range);
+
+  // An unaligned size is rounded up and takes the quick listed range
+  ASSERT_TRUE(dxmaResize(allocator, buffer, range + 1));
+  ASSERT_EQ(buffer->GetOffset(), 0);
+  ASSERT_EQ(buffer->GetSize(), 2 * range);
+  ASSERT_EQ(allocator->GetQuickListBytes(), 0);
+  DxmaHeapTypeStats stats{};
+  dxmaGetHeapTypeStats(allocator, D3D12_HEAP_TYPE_UPLOAD, &stats);
+  ASSERT_EQ(stats.allocation_bytes, 3 * range);
+
+  dxmaFree(allocator, last, nullptr);
+  dxmaFree(allocator, buffer, nullptr);
+  dxmaDestroyAllocator(allocator);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();